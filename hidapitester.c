@@ -5,6 +5,10 @@
  *
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE   // for sched_setaffinity()
+#endif
+
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -12,8 +16,18 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <getopt.h>
+#include <signal.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>   // for _mkdir()
+#endif
 
 #include "hidapi.h"
+#ifndef _WIN32
+#include "hidapitester_shm.h"
+#endif
 
 
 #define MAX_STR 1024  // for manufacturer, product strings
@@ -37,10 +51,12 @@ static void print_usage(char *myname)
 "  --list                      List HID devices (by filters)\n"
 "  --list-usages               List HID devices w/ usages (by filters)\n"
 "  --list-detail               List HID devices w/ details (by filters)\n"
+"  --list-descriptors[=<msecs>] List as JSON w/ report sizes, msecs per device\n"
 "  --open                      Open device with previously selected filters\n"
 "  --open-path <pathstr>       Open device by path (as in --list-detail) \n"
 "  --close                     Close currently open device \n"
 "  --get-report-descriptor     Get the report descriptor\n"
+"  --descriptor-file <file>    Print reports and Input fields of a descriptor saved as hex\n"
 "  --send-feature <datalist>   Send Feature report (1st byte reportId, if used)\n"
 "  --read-feature <reportId>   Read Feature report (w/ reportId, 0 if unused) \n"
 "  --send-output <datalist>    Send Ouput report to device \n"
@@ -48,6 +64,46 @@ static void print_usage(char *myname)
 "  --read-input-forever        Read Input reports in a loop forever \n"
 "  --read-input-report <reportId>  Read Input report from specific reportId \n"
 "  --read-input-report-forever <rId>  Read Input report from specific reportId in a loop\n"
+"  --shm <name>                Publish Input reports to POSIX shared-memory ring\n"
+"  --seq <offset:width>        Track sequence counter in Input reports for loss/reorders\n"
+"  --send-output-file <file>   Send Output reports from file (or - for stdin), one per line\n"
+"  --send-feature-file <file>  Send Feature reports from file (or - for stdin), one per line\n"
+"  --read-input-file <file>    Handle Input reports from file as if read from a device\n"
+"  --file-format <hex|bin>     Report files are hex lines (default) or --length byte records\n"
+"  --pipeline <count>          Send count requests (last --send-output) & match responses\n"
+"  --window <n>                Max requests in flight for --pipeline (default 1)\n"
+"  --tag-offset <out[:in]>     Offset of tag byte in request [and response] (default 1)\n"
+"  --retries <n>               Resend timed out --pipeline requests n times (default 0)\n"
+"  --pipeline-compare          Rerun each --pipeline with a window of 1 to compare\n"
+"  --read-all-interfaces[=<msecs>]  Read every interface of the matching device at\n"
+"                              once, merged in time order (msecs reorder window, default 10)\n"
+"  --duplex <source>           Read Input reports while writing reports from source:\n"
+"                              <file>, - (stdin), or rate:<hz>[:<count>] (last --send-output);\n"
+"                              prefix feature: to write Feature reports\n"
+"  --stress <secs>             Random reads & writes of random lengths & reportIds\n"
+"  --seed <n>                  Random seed for --stress, to replay a run\n"
+"  --bench-sweep[=<lengths>]   CSV of throughput & latency per transfer kind & length\n"
+"  --bench-count <n>           Transfers per --bench-sweep row (default 100)\n"
+"  --timestamps[=<usecs>]      Timestamp Input reports, flag gaps over usecs, print jitter\n"
+"  --expect <offset:bytes>     Check bytes of last report read, fail (exit 1) if different\n"
+"  --test-spec <file>          Run file of steps (one line of args each), pass/fail per step\n"
+"  --step <name>               Start a named, timed step (as --test-spec lines do)\n"
+"  --reconnect[=<secs>]        On read error in forever loops, reopen device (give up after secs)\n"
+"  --summarize <msecs>         Print per-byte/field min/max/mean/variance per window\n"
+"  --split-by-report-id <dir|pattern>  Write Input reports to a file per reportId\n"
+"                              (dir/report-XX.hex, or pattern with %%d or %%x)\n"
+"  --verify-crc <algo:start-end:offset[:be]>  Check CRC of Input reports\n"
+"                              (crc8, crc16 (CCITT), crc32, sum), count valid/invalid\n"
+"  --crc-failures-only         Print only Input reports that fail --verify-crc\n"
+"  --batch <max>               Drain up to max queued Input reports per read wakeup\n"
+"  --rt[=<prio>]               Use SCHED_FIFO (default prio 50) and lock memory (Linux)\n"
+"  --cpu <n>                   Pin process to CPU n (Linux)\n"
+"  --trace <file>              Write hidapi call timeline as Chrome trace JSON at exit\n"
+"  --cache                     Keep report descriptors in an on-disk cache\n"
+"  --no-cache                  Always read report descriptors from the device (default)\n"
+"  --refresh-cache             Re-read report descriptors and update the cache\n"
+"  --repeat <n>                Run the whole command line n times\n"
+"  --repeat-for <secs>         Run the whole command line repeatedly for secs seconds\n"
 "  --length <len>, -l <len>    Set buffer length in bytes of report to send/read\n"
 "  --timeout <msecs>           Timeout in millisecs to wait for input reads \n"
 "  --base <base>, -b <base>    Set decimal or hex buffer print mode\n"
@@ -59,6 +115,7 @@ static void print_usage(char *myname)
 "Notes: \n"
 " . Commands are executed in order. \n"
 " . --vidpid, --usage, --usagePage, --serial act as filters to --open and --list \n"
+" . The command line is checked before any command runs; --repeat re-runs all of it \n"
 "\n"
 "Examples: \n"
 ". List all devices \n"
@@ -93,10 +150,12 @@ enum {
     CMD_LIST_USAGES,
     CMD_LIST_DETAIL,
     CMD_LIST_JSON,
+    CMD_LIST_DESCRIPTORS,
     CMD_OPEN,
     CMD_OPEN_PATH,
     CMD_CLOSE,
     CMD_GET_REPORT_DESCRIPTOR,
+    CMD_DESCRIPTOR_FILE,
     CMD_SEND_OUTPUT,
     CMD_SEND_FEATURE,
     CMD_READ_INPUT,
@@ -104,6 +163,45 @@ enum {
     CMD_READ_INPUT_FOREVER,
     CMD_READ_INPUT_REPORT,
     CMD_READ_INPUT_REPORT_FOREVER,
+    CMD_SHM,
+    CMD_SEQ,
+    CMD_BATCH,
+    CMD_TIMESTAMPS,
+    CMD_SUMMARIZE,
+    CMD_SPLIT,
+    CMD_VERIFY_CRC,
+    CMD_CRC_FAILURES_ONLY,
+    CMD_EXPECT,
+    CMD_RECONNECT,
+    CMD_STEP,
+    CMD_SEND_OUTPUT_FILE,
+    CMD_SEND_FEATURE_FILE,
+    CMD_READ_INPUT_FILE,
+    CMD_FILE_FORMAT,
+    CMD_PIPELINE,
+    CMD_DUPLEX,
+    CMD_READ_ALL_INTERFACES,
+    CMD_WINDOW,
+    CMD_TAG_OFFSET,
+    CMD_RETRIES,
+    CMD_PIPELINE_COMPARE,
+    CMD_STRESS,
+    CMD_SEED,
+    CMD_BENCH_SWEEP,
+    CMD_BENCH_COUNT,
+    CMD_REPEAT,
+    CMD_REPEAT_FOR,
+    CMD_RT,
+    CMD_CPU,
+    CMD_TRACE,
+    CMD_CACHE,
+    CMD_NO_CACHE,
+    CMD_REFRESH_CACHE,
+    CMD_HELP,
+    CMD_LENGTH,
+    CMD_TIMEOUT,
+    CMD_BASE,
+    CMD_WIDTH,
     CMD_NUM_COMMANDS,
 };
 
@@ -115,12 +213,41 @@ int print_width = 32; // how many characters per line
 
 #ifdef _WIN32
 #include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include <process.h>  // for _getpid()
 #define sleep_ms(ms) Sleep(ms)
 #else
 #include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sched.h>
+#ifdef __linux__
+#include <sys/syscall.h>  // for SYS_gettid
+#endif
+#include <pthread.h>
 #define sleep_ms(ms) usleep((ms) * 1000)
 #endif
 
+/**
+ * monotonic clock in nanoseconds, for timestamping reports
+ */
+uint64_t now_nsec(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER count;
+    if( !freq.QuadPart ) { QueryPerformanceFrequency(&freq); }
+    QueryPerformanceCounter(&count);
+    return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000000ull +
+        (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000000ull / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
 /**
  * printf that can be shut up
  */
@@ -142,28 +269,323 @@ void msginfo(char* fmt, ...)
     va_end(args);
 }
 
+volatile sig_atomic_t stop_requested = 0;
+
 /**
- * print out a buffer of len bufsize in decimal or hex form
+ * Ctrl-C ends "forever" loops so summaries still get printed.
+ * A second Ctrl-C kills the process as usual.
  */
-void printbuf(uint8_t* buf, int bufsize, int base, int width)
+void on_sigint(int sig)
+{
+    stop_requested = 1;
+    signal(sig, SIG_DFL);
+}
+
+/**
+ * "--trace": every hidapi call is recorded as a begin/end pair into a
+ * preallocated event buffer, then written out at exit as Chrome
+ * trace-event JSON (chrome://tracing or ui.perfetto.dev).  Recording costs
+ * two clock reads and an atomic increment per call, so it can stay on
+ * while streaming reports.
+ */
+typedef struct {
+    const char* name;       // hidapi function
+    uint64_t begin_ns;
+    uint64_t end_ns;
+    uint32_t tid;
+    int32_t result;         // bytes transferred, or return code
+    bool bytes;             // 'result' is a byte count
+} trace_event_t;
+
+#define TRACE_MAX_EVENTS (1 << 20)
+
+trace_event_t* trace_events = NULL;  // NULL unless "--trace" used
+char* trace_file = NULL;
+uint64_t trace_next = 0;             // next free event, may pass TRACE_MAX_EVENTS
+uint64_t trace_start_ns = 0;
+
+static uint32_t trace_tid(void)
+{
+#if defined(_WIN32)
+    return (uint32_t)GetCurrentThreadId();
+#elif defined(__linux__)
+    static __thread uint32_t tid = 0;
+    if( !tid ) { tid = (uint32_t)syscall(SYS_gettid); }
+    return tid;
+#elif defined(__APPLE__)
+    uint64_t tid;
+    pthread_threadid_np(NULL, &tid);
+    return (uint32_t)tid;
+#else
+    return 0;
+#endif
+}
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+// set by a worker thread that may be given up on: while *trace_cancel is
+// non-zero, the thread's calls aren't recorded (main may be done with the trace)
+THREAD_LOCAL int* trace_cancel = NULL;
+
+void trace_add(const char* name, uint64_t begin_ns, int result, bool bytes)
+{
+    uint64_t end_ns = now_nsec();
+#ifdef _MSC_VER
+    if( trace_cancel && InterlockedOr((volatile LONG*)trace_cancel, 0) ) { return; }
+#else
+    if( trace_cancel && __atomic_load_n(trace_cancel, __ATOMIC_ACQUIRE) ) { return; }
+#endif
+#ifdef _MSC_VER
+    uint64_t i = (uint64_t)InterlockedIncrement64((LONG64*)&trace_next) - 1;
+#else
+    uint64_t i = __atomic_fetch_add(&trace_next, 1, __ATOMIC_RELAXED);
+#endif
+    if( i >= TRACE_MAX_EVENTS ) { return; }  // full, counted as dropped
+    trace_event_t* e = &trace_events[i];
+    e->name = name;
+    e->begin_ns = begin_ns;
+    e->end_ns = end_ns;
+    e->tid = trace_tid();
+    e->result = result;
+    e->bytes = bytes;
+}
+
+/**
+ * Write the recorded events to 'trace_file'. Timestamps are microseconds
+ * since "--trace" was parsed; "start_monotonic_ns" gives the clock value
+ * of time 0 so traces can be lined up with other monotonic-clock logs.
+ * The buffer is freed only if 'release', i.e. no other thread can still
+ * be in a traced call.
+ */
+void trace_flush(bool release)
+{
+    if( !trace_events ) { return; }
+    FILE* fp = fopen(trace_file, "w");
+    if( !fp ) {
+        msg("Error: could not write trace file '%s': %s\n", trace_file, strerror(errno));
+        return;
+    }
+#ifdef _WIN32
+    int pid = _getpid();
+#else
+    int pid = getpid();
+#endif
+    uint64_t n = (trace_next < TRACE_MAX_EVENTS) ? trace_next : TRACE_MAX_EVENTS;
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\n\"otherData\":{\"start_monotonic_ns\":\"%llu\"},\n"
+            "\"traceEvents\":[\n", (unsigned long long)trace_start_ns);
+    fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"hidapitester\"}}",
+            pid);
+    for( uint64_t i=0; i<n; i++ ) {
+        trace_event_t* e = &trace_events[i];
+        fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"hidapi\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":%d,\"tid\":%u}",
+                e->name, (e->begin_ns - trace_start_ns) / 1e3, pid, e->tid);
+        fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"hidapi\",\"ph\":\"E\",\"ts\":%.3f,\"pid\":%d,\"tid\":%u,"
+                "\"args\":{\"%s\":%d}}", e->name, (e->end_ns - trace_start_ns) / 1e3, pid, e->tid,
+                e->bytes ? "bytes" : "result", e->result);
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+    msg("Trace: wrote %llu hidapi calls to %s\n", (unsigned long long)n, trace_file);
+    if( trace_next > n ) {
+        msg("Trace: buffer full, %llu calls not recorded\n", (unsigned long long)(trace_next - n));
+    }
+    if( release ) {
+        free(trace_events);
+        trace_events = NULL;
+    }
+}
+
+// body of a traced hidapi wrapper: make 'call', record it, return its value
+#define TRACED(name, bytes, type, call, result) \
+    if( !trace_events ) { return call; }     \
+    uint64_t t = now_nsec();                 \
+    type r = call;                           \
+    trace_add(name, t, (result), bytes);     \
+    return r;
+
+static int enumerate_count(struct hid_device_info* d)
+{
+    int n = 0;
+    for( ; d; d = d->next ) { n++; }
+    return n;
+}
+
+struct hid_device_info* trace_hid_enumerate(unsigned short v, unsigned short p)
+    { TRACED("hid_enumerate", false, struct hid_device_info*, hid_enumerate(v, p), enumerate_count(r)) }
+hid_device* trace_hid_open(unsigned short v, unsigned short p, const wchar_t* s)
+    { TRACED("hid_open", false, hid_device*, hid_open(v, p, s), r ? 0 : -1) }
+hid_device* trace_hid_open_path(const char* path)
+    { TRACED("hid_open_path", false, hid_device*, hid_open_path(path), r ? 0 : -1) }
+int trace_hid_write(hid_device* d, const unsigned char* data, size_t len)
+    { TRACED("hid_write", true, int, hid_write(d, data, len), r) }
+int trace_hid_read(hid_device* d, unsigned char* data, size_t len)
+    { TRACED("hid_read", true, int, hid_read(d, data, len), r) }
+int trace_hid_read_timeout(hid_device* d, unsigned char* data, size_t len, int ms)
+    { TRACED("hid_read_timeout", true, int, hid_read_timeout(d, data, len, ms), r) }
+int trace_hid_set_nonblocking(hid_device* d, int nonblock)
+    { TRACED("hid_set_nonblocking", false, int, hid_set_nonblocking(d, nonblock), r) }
+int trace_hid_send_feature_report(hid_device* d, const unsigned char* data, size_t len)
+    { TRACED("hid_send_feature_report", true, int, hid_send_feature_report(d, data, len), r) }
+int trace_hid_get_feature_report(hid_device* d, unsigned char* data, size_t len)
+    { TRACED("hid_get_feature_report", true, int, hid_get_feature_report(d, data, len), r) }
+int trace_hid_get_input_report(hid_device* d, unsigned char* data, size_t len)
+    { TRACED("hid_get_input_report", true, int, hid_get_input_report(d, data, len), r) }
+int trace_hid_get_report_descriptor(hid_device* d, unsigned char* data, size_t len)
+    { TRACED("hid_get_report_descriptor", true, int, hid_get_report_descriptor(d, data, len), r) }
+struct hid_device_info* trace_hid_get_device_info(hid_device* d)
+    { TRACED("hid_get_device_info", false, struct hid_device_info*, hid_get_device_info(d), r ? 0 : -1) }
+int trace_hid_exit(void)
+    { TRACED("hid_exit", false, int, hid_exit(), r) }
+
+void trace_hid_close(hid_device* d)
+{
+    uint64_t t = now_nsec();
+    hid_close(d);
+    if( trace_events ) { trace_add("hid_close", t, 0, false); }
+}
+
+void trace_hid_free_enumeration(struct hid_device_info* devs)
+{
+    uint64_t t = now_nsec();
+    hid_free_enumeration(devs);
+    if( trace_events ) { trace_add("hid_free_enumeration", t, 0, false); }
+}
+
+// from here on, hidapi calls go through the wrappers above
+#define hid_enumerate             trace_hid_enumerate
+#define hid_free_enumeration      trace_hid_free_enumeration
+#define hid_open                  trace_hid_open
+#define hid_open_path             trace_hid_open_path
+#define hid_close                 trace_hid_close
+#define hid_write                 trace_hid_write
+#define hid_read                  trace_hid_read
+#define hid_read_timeout          trace_hid_read_timeout
+#define hid_set_nonblocking       trace_hid_set_nonblocking
+#define hid_send_feature_report   trace_hid_send_feature_report
+#define hid_get_feature_report    trace_hid_get_feature_report
+#define hid_get_input_report      trace_hid_get_input_report
+#define hid_get_report_descriptor trace_hid_get_report_descriptor
+#define hid_get_device_info       trace_hid_get_device_info
+#define hid_exit                  trace_hid_exit
+
+/**
+ * Minimal threads and atomics for the few commands that use threads:
+ * pthreads, or Win32 threads on Windows so MSVC builds need nothing extra
+ */
+#ifdef _WIN32
+typedef HANDLE thread_t;
+
+typedef struct {
+    void* (*fn)(void*);
+    void* arg;
+} thread_start_t;
+
+static DWORD WINAPI thread_trampoline(LPVOID p)
+{
+    thread_start_t s = *(thread_start_t*)p;
+    free(p);
+    s.fn(s.arg);
+    return 0;
+}
+
+bool thread_start(thread_t* t, void* (*fn)(void*), void* arg)
+{
+    thread_start_t* s = malloc(sizeof(thread_start_t));
+    s->fn = fn;
+    s->arg = arg;
+    *t = CreateThread(NULL, 0, thread_trampoline, s, 0, NULL);
+    if( !*t ) { free(s); }
+    return *t != NULL;
+}
+void thread_join(thread_t t)   { WaitForSingleObject(t, INFINITE); CloseHandle(t); }
+void thread_detach(thread_t t) { CloseHandle(t); }
+typedef CRITICAL_SECTION mutex_t;
+#define mutex_init(m)   InitializeCriticalSection(m)
+#define mutex_lock(m)   EnterCriticalSection(m)
+#define mutex_unlock(m) LeaveCriticalSection(m)
+#define mutex_destroy(m) DeleteCriticalSection(m)
+#else
+typedef pthread_t thread_t;
+
+bool thread_start(thread_t* t, void* (*fn)(void*), void* arg)
+{
+    return pthread_create(t, NULL, fn, arg) == 0;
+}
+void thread_join(thread_t t)   { pthread_join(t, NULL); }
+void thread_detach(thread_t t) { pthread_detach(t); }
+
+typedef pthread_mutex_t mutex_t;
+#define mutex_init(m)   pthread_mutex_init((m), NULL)
+#define mutex_lock(m)   pthread_mutex_lock(m)
+#define mutex_unlock(m) pthread_mutex_unlock(m)
+#define mutex_destroy(m) pthread_mutex_destroy(m)
+#endif
+
+#ifdef _MSC_VER
+#define atomic_load_int(p)         InterlockedOr((volatile LONG*)(p), 0)
+#define atomic_store_int(p, v)     InterlockedExchange((volatile LONG*)(p), (v))
+#define atomic_fetch_add_int(p, v) InterlockedExchangeAdd((volatile LONG*)(p), (v))
+#define atomic_cas_int(p, old, v)  (InterlockedCompareExchange((volatile LONG*)(p), (v), (old)) == (old))
+#else
+#define atomic_load_int(p)         __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define atomic_store_int(p, v)     __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define atomic_fetch_add_int(p, v) __atomic_fetch_add((p), (v), __ATOMIC_ACQ_REL)
+#define atomic_cas_int(p, old, v)  __extension__ ({ int _o = (old); \
+        __atomic_compare_exchange_n((p), &_o, (v), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE); })
+#endif
+
+// room formatbuf() needs for 'n' bytes, worst case
+#define FORMATBUF_SIZE(n) (5*(n) + 2)
+
+/**
+ * format a buffer of len bufsize in decimal or hex form into 'out'
+ * (of at least FORMATBUF_SIZE(bufsize) chars)
+ * Returns number of chars written, not counting the terminating NUL
+ */
+int formatbuf(char* out, uint8_t* buf, int bufsize, int base, int width)
 {
+    static const char hexdigits[] = "0123456789ABCDEF";
+    char* p = out;
     for( int i=0 ; i<bufsize; i++) {
-        if( base==10 ) {
-            printf(" %3d", buf[i]);
-        } else if( base==16 ) {
-            printf(" %02X", buf[i] );
+        uint8_t b = buf[i];
+        if( base==10 ) {  // " %3d"
+            *p++ = ' ';
+            *p++ = (b >= 100) ? '0' + b/100 : ' ';
+            *p++ = (b >= 10) ? '0' + (b/10)%10 : ' ';
+            *p++ = '0' + b%10;
+        } else if( base==16 ) {  // " %02X"
+            *p++ = ' ';
+            *p++ = hexdigits[b >> 4];
+            *p++ = hexdigits[b & 0xf];
         }
-       // if (i % 16 == 15 && i < bufsize-1) printf("\n");
-       if (i % width == width-1 && i < bufsize-1) printf("\n");
+       if (i % width == width-1 && i < bufsize-1) *p++ = '\n';
     }
-    printf("\n");
+    *p++ = '\n';
+    *p = '\0';
+    return p - out;
+}
+
+/**
+ * print out a buffer of len bufsize in decimal or hex form
+ */
+void printbuf(uint8_t* buf, int bufsize, int base, int width)
+{
+    static char out[FORMATBUF_SIZE(HID_API_MAX_REPORT_DESCRIPTOR_SIZE)];
+    if( bufsize > HID_API_MAX_REPORT_DESCRIPTOR_SIZE ) {
+        bufsize = HID_API_MAX_REPORT_DESCRIPTOR_SIZE;
+    }
+    fwrite(out, 1, formatbuf(out, buf, bufsize, base, width), stdout);
 }
 
 /**
  * Parse a comma-delimited 'string' containing numbers (dec,hex)
  * into a array'buffer' (of element size 'bufelem_size') and
  * of max length 'buflen', using delimiter 'delim_str'
- * Returns number of bytes written
+ * Returns number of bytes written, or -1 if an item isn't a number
  */
 int str2buf(void* buffer, char* delim_str, char* string, int buflen, int bufelem_size)
 {
@@ -173,11 +595,14 @@ int str2buf(void* buffer, char* delim_str, char* string, int buflen, int bufelem
     memset(buffer, 0, buflen);  // bzero() not defined on Win32?
     while((s = strtok(string, delim_str)) != NULL && pos < buflen){
         string = NULL;
+        char* end;
+        long v = strtol(s, &end, 0);
+        if( *end != '\0' ) return -1;
         switch(bufelem_size) {
         case 1:
-            ((uint8_t*)buffer)[pos++] = (uint8_t)strtol(s, NULL, 0); break;
+            ((uint8_t*)buffer)[pos++] = (uint8_t)v; break;
         case 2:
-            ((int*)buffer)[pos++] = (int)strtol(s, NULL, 0); break;
+            ((int*)buffer)[pos++] = (int)v; break;
         }
     }
     return pos;
@@ -223,404 +648,3321 @@ static void json_print_wstr(const wchar_t* ws) {
     json_print_str(buf);
 }
 
+#ifndef _WIN32
+hidapitester_shm_header* shm_ring = NULL; // input report ring, if "--shm" used
+size_t shm_ring_size = 0;
+#endif
+
 /**
- *
+ * Create (or re-create) the shared-memory input report ring 'name'
+ * Returns 0 on success, -1 on error
  */
-int main(int argc, char* argv[])
+int shm_ring_open(const char* name)
 {
-    uint8_t buf[MAX_BUF];   // data buffer for send/recv
-    hid_device *dev = NULL; // HIDAPI device we will open
-    int res;
-    int i;
-    int buflen = 64;        // length of buf in use
-    int cmd = CMD_NONE;     //
-    int timeout_millis = 250;
-
-    uint16_t vid = 0;        // vendorId
-    uint16_t pid = 0;        // productId
-    uint16_t usage_page = 0; // usagePage to search for, if any
-    uint16_t usage = 0;      // usage to search for, if any
-    wchar_t serial_wstr[MAX_STR/4] = {L'\0'}; // serial number string rto search for, if any
-    char devpath[MAX_STR];   // path to open, if filter by usage
-    unsigned char descriptorBuf[HID_API_MAX_REPORT_DESCRIPTOR_SIZE];
-
-    setbuf(stdout, NULL);  // turn off buffering of stdout
+#ifdef _WIN32
+    msg("Error: --shm is not supported on this platform\n");
+    return -1;
+#else
+    size_t size = hidapitester_shm_size(HIDAPITESTER_SHM_SLOTS, HIDAPITESTER_SHM_SLOT_SIZE);
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if( fd < 0 ) {
+        msg("Error: could not create shared memory '%s'\n", name);
+        return -1;
+    }
+    struct stat st;
+    if( fstat(fd, &st) != 0 ) st.st_size = 0;
+    if( st.st_size != 0 && (size_t)st.st_size != size ) {
+        close(fd);                      // left by a build with another layout
+        shm_unlink(name);
+        fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+        if( fd < 0 || fstat(fd, &st) != 0 ) st.st_size = -1;
+    }
+    void* p = MAP_FAILED;
+    // reuse the object a previous run left in place: macOS can't ftruncate() it again
+    if( fd >= 0 && ((size_t)st.st_size == size || ftruncate(fd, size) == 0) ) {
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if( fd >= 0 ) close(fd);
+    if( p == MAP_FAILED ) {
+        msg("Error: could not map shared memory '%s'\n", name);
+        return -1;
+    }
+    memset(p, 0, size);
+    hidapitester_shm_header* ring = p;
+    ring->slot_count  = HIDAPITESTER_SHM_SLOTS;
+    ring->slot_size   = HIDAPITESTER_SHM_SLOT_SIZE;
+    ring->slot_stride = hidapitester_shm_stride(HIDAPITESTER_SHM_SLOT_SIZE);
+    ring->version     = HIDAPITESTER_SHM_VERSION;
+    ring->writer_alive = 1;
+    __atomic_store_n(&ring->magic, HIDAPITESTER_SHM_MAGIC, __ATOMIC_RELEASE);
+    shm_ring = ring;
+    shm_ring_size = size;
+    return 0;
+#endif
+}
 
-    if(argc < 2){
-        print_usage( "hidapitester" );
-        exit(1);
+/**
+ * Publish one input report to the ring, if one is open
+ */
+void shm_ring_publish(uint8_t* buf, int len, uint64_t t)
+{
+#ifndef _WIN32
+    if( shm_ring && len > 0 ) {
+        hidapitester_shm_publish(shm_ring, buf, len, t);
     }
+#endif
+}
 
-    struct option longoptions[] =
-        {
-         {"help", no_argument, 0, 'h'},
-         {"version",      no_argument, &cmd,         CMD_VERSION},
-         {"verbose",      no_argument, 0,            'v'},
-         {"quiet",        optional_argument, 0,      'q'},
-         {"timeout",      required_argument, 0,      't'},
-         {"length",       required_argument, 0,      'l'},
-         {"buflen",       required_argument, 0,      'l'},
-         {"base",         required_argument, 0,      'b'},
-         {"width",        required_argument, 0,      'w'},
-         {"vidpid",       required_argument, &cmd,   CMD_VIDPID},
-         {"usage",        required_argument, &cmd,   CMD_USAGE},
-         {"usagePage",    required_argument, &cmd,   CMD_USAGEPAGE},
-         {"serial",       required_argument, &cmd,   CMD_SERIALNUMBER},
-         {"list",         no_argument,       &cmd,   CMD_LIST},
-         {"list-usages",  no_argument,       &cmd,   CMD_LIST_USAGES},
-         {"list-detail",  no_argument,       &cmd,   CMD_LIST_DETAIL},
-         {"list-json",    no_argument,       &cmd,   CMD_LIST_JSON},
-         {"open",         no_argument,       &cmd,   CMD_OPEN},
-         {"open-path",    required_argument, &cmd,   CMD_OPEN_PATH},
-         {"close",        no_argument,       &cmd,   CMD_CLOSE},
-         {"send-output",  required_argument, &cmd,   CMD_SEND_OUTPUT},
-         {"send-out",     required_argument, &cmd,   CMD_SEND_OUTPUT},
-         {"send-feature", required_argument, &cmd,   CMD_SEND_FEATURE},
-         {"read-input",   no_argument,       &cmd,   CMD_READ_INPUT},
-         {"read-in",      no_argument,       &cmd,   CMD_READ_INPUT},
-         {"read-input-report", required_argument, &cmd,  CMD_READ_INPUT_REPORT},
-         {"read-feature", required_argument, &cmd,   CMD_READ_FEATURE},
-         {"read-input-forever",  optional_argument, &cmd,   CMD_READ_INPUT_FOREVER},
-         {"read-input-report-forever",  required_argument, &cmd,   CMD_READ_INPUT_REPORT_FOREVER},
-         {"get-report-descriptor", no_argument, &cmd, CMD_GET_REPORT_DESCRIPTOR},
-         {NULL,0,0,0}
-        };
-    char* shortopts = "vht:l:qb:w:";
+/**
+ * Mark the ring as finished and unmap it. The shm object itself is left
+ * in place so readers can drain it; remove it with shm_unlink() when done.
+ */
+void shm_ring_close(void)
+{
+#ifndef _WIN32
+    if( !shm_ring ) return;
+    __atomic_store_n(&shm_ring->writer_alive, 0, __ATOMIC_RELEASE);
+    munmap(shm_ring, shm_ring_size);
+    shm_ring = NULL;
+#endif
+}
 
-    bool done = false;
-    int option_index = 0, opt;
-    while(!done) {
-        memset(buf,0, MAX_BUF);   // reset buffers
-        memset(devpath,0,MAX_STR);
+/**
+ * Sequence-number tracking for "--seq", to tell dropped, duplicated,
+ * and reordered input reports apart.  'window' has bit i set if
+ * value (expected-1-i) has been seen, so late arrivals can be classified.
+ */
+typedef struct {
+    int offset;             // byte offset of the counter in each report
+    int width;              // counter width in bytes (1,2,4), little-endian
+    bool enabled;
+    bool started;
+    uint32_t mask;          // counter wraps at mask+1
+    uint32_t expected;      // next expected counter value
+    uint64_t window;
+    uint64_t received;      // reports with a counter in them
+    uint64_t lost;          // counter values never seen (so far)
+    uint64_t duplicates;
+    uint64_t reorders;      // values that arrived after a later one
+    uint64_t resyncs;       // large backward jumps, e.g. device reset
+    uint64_t longest_gap;
+    uint64_t last_print_ns;
+} seq_tracker_t;
 
-        opt = getopt_long(argc, argv, shortopts, longoptions, &option_index);
-        if (opt==-1) done = true; // parsed all the args
-        switch(opt) {
-        case 0:                   // long opts with no short opts
+seq_tracker_t seq;
 
-            if( cmd == CMD_VIDPID ) {
+#define SEQ_PRINT_NSEC 1000000000ull  // print stats every second while reading
 
-                if( sscanf(optarg, "%6hx/%6hx", &vid,&pid) !=2 ) {  // match "23FE/AB12" or "0x23FE/0xAB12"
-                    if( !sscanf(optarg, "%6hx:%6hx", &vid,&pid) ) { // match "23FE:AB12" or "0x23FE:0xAB12"
-                        // else try parsing standard dec/hex values
-                        int wordbuf[4]; // a little extra space
-                        int parsedlen = str2buf(wordbuf, ":/, ", optarg, sizeof(wordbuf), 2);
-                        vid = wordbuf[0]; pid = wordbuf[1];
-                    }
-                }
-                msginfo("Looking for vid/pid 0x%04X / 0x%04X  (%d / %d)\n",vid,pid,vid,pid);
-            }
-            else if( cmd == CMD_USAGEPAGE ) {
+/**
+ * Set up tracking of a 'width'-byte counter at 'offset'
+ */
+void seq_config(int offset, int width)
+{
+    if( seq.enabled && seq.offset == offset && seq.width == width ) {
+        return;  // keep counting across --repeat iterations
+    }
+    memset(&seq, 0, sizeof(seq));
+    seq.offset = offset;
+    seq.width = width;
+    seq.mask = (width == 4) ? 0xffffffff : ((1u << (8*width)) - 1);
+    seq.enabled = true;
+}
 
-                if( (usage_page = strtol(optarg,NULL,0)) == 0 ) { // if bad parse
-                    sscanf(optarg, "%4hx", &usage_page ); // try bare "ABCD"
-                }
+void seq_print_stats(void)
+{
+    uint64_t total = seq.received - seq.duplicates + seq.lost;
+    printf("Seq: received %llu, lost %llu (%.3f%%), duplicates %llu, reorders %llu, resyncs %llu, longest gap %llu\n",
+           (unsigned long long)seq.received, (unsigned long long)seq.lost,
+           total ? 100.0 * seq.lost / total : 0.0,
+           (unsigned long long)seq.duplicates, (unsigned long long)seq.reorders,
+           (unsigned long long)seq.resyncs, (unsigned long long)seq.longest_gap);
+}
 
-                msginfo("Set usagePage to 0x%04hX (%d)\n", usage_page,usage_page);
-            }
-            else if( cmd == CMD_USAGE ) {
+/**
+ * Account for one input report of 'len' bytes
+ */
+void seq_track(uint8_t* report, int len)
+{
+    if( !seq.enabled || len < seq.offset + seq.width ) return;
 
-                if( (usage = strtol(optarg,NULL,0)) == 0 ) { // if bad parse
-                    sscanf(optarg, "%4hx", &usage ); // try bare "ABCD"
-                }
-                msginfo("Set usage to 0x%04hX (%d)\n", usage,usage);
-            }
-            else if( cmd == CMD_SERIALNUMBER ) {
+    uint32_t val = 0;
+    for( int i = seq.width-1; i >= 0; i-- ) {
+        val = (val << 8) | report[seq.offset + i];
+    }
+    seq.received++;
 
-                mbstowcs( serial_wstr, optarg, sizeof(serial_wstr)/sizeof(wchar_t));
-            }
-            else if( cmd == CMD_LIST ||
-                     cmd == CMD_LIST_USAGES ||
-                     cmd == CMD_LIST_DETAIL ) {
+    uint32_t half = seq.mask / 2 + 1;
+    uint32_t ahead = (val - seq.expected) & seq.mask;
+    if( !seq.started ) {
+        seq.started = true;
+        seq.window = 1;
+        seq.expected = (val + 1) & seq.mask;
+    }
+    else if( ahead < half ) {  // in order, or skipped 'ahead' values
+        seq.lost += ahead;
+        if( ahead > seq.longest_gap ) seq.longest_gap = ahead;
+        seq.window = (ahead + 1 >= 64) ? 1 : (seq.window << (ahead + 1)) | 1;
+        seq.expected = (val + 1) & seq.mask;
+    }
+    else {
+        uint32_t back = (seq.expected - 1 - val) & seq.mask;
+        if( back >= 64 ) {     // too far back to be a late report
+            seq.resyncs++;
+            seq.window = 1;
+            seq.expected = (val + 1) & seq.mask;
+        }
+        else if( seq.window & (1ull << back) ) {
+            seq.duplicates++;
+        }
+        else {                 // late arrival of a value counted as lost
+            seq.window |= (1ull << back);
+            seq.reorders++;
+            if( seq.lost ) seq.lost--;
+        }
+    }
 
-                struct hid_device_info *devs, *cur_dev;
-                devs = hid_enumerate(vid,pid); // 0,0 = find all devices
-                if (!devs) {
-                    fprintf(stderr, "No HID devices found\n");
-                    hid_exit();
-                    return 1;
-                }
+    uint64_t now = now_nsec();
+    if( now - seq.last_print_ns >= SEQ_PRINT_NSEC ) {
+        if( seq.last_print_ns && !msg_quiet ) { seq_print_stats(); }
+        seq.last_print_ns = now;
+    }
+}
 
-                cur_dev = devs;
-                while (cur_dev) {
-                    if( (!usage_page || cur_dev->usage_page == usage_page) &&
-                        (!usage || cur_dev->usage == usage) &&
-                        (serial_wstr[0]==L'\0' || wcscmp(cur_dev->serial_number, serial_wstr)==0) ) {
-                        if( cmd == CMD_LIST_USAGES ) {
-                            printf("%04X/%04X / %04hX/%04hX  %ls - %ls\n",
-                                   cur_dev->vendor_id, cur_dev->product_id,
-                                   cur_dev->usage_page, cur_dev->usage ,
-                                   cur_dev->manufacturer_string, cur_dev->product_string );
-                        }
-                        else {
-                            printf("%04X/%04X: %ls - %ls\n",
-                                   cur_dev->vendor_id, cur_dev->product_id,
-                                   cur_dev->manufacturer_string, cur_dev->product_string );
-                        }
-
-                        if( cmd == CMD_LIST_DETAIL ) {
-                            printf("  vendorId:      0x%04hX\n", cur_dev->vendor_id);
-                            printf("  productId:     0x%04hX\n", cur_dev->product_id);
-                            printf("  usagePage:     0x%04hX\n", cur_dev->usage_page);
-                            printf("  usage:         0x%04hX\n", cur_dev->usage );
-                            printf("  serial_number: %ls \n", cur_dev->serial_number);
-                            printf("  interface:     %d \n", cur_dev->interface_number);
-                            printf("  bus_type:      %s (%d) \n",
-                                   bus_type_name(cur_dev->bus_type), cur_dev->bus_type);
-                            printf("  path: %s\n",cur_dev->path);
-                            printf("\n");
-                        }
-                    }
-                    cur_dev = cur_dev->next;
-                }
-                hid_free_enumeration(devs);
-            }
-            else if( cmd == CMD_LIST_JSON ) {
-                struct hid_device_info *devs, *cur_dev;
-                devs = hid_enumerate(vid, pid);
-                if (!devs) {
-                    fprintf(stderr, "No HID devices found\n");
-                    printf("{\n    \"error\": \"No HID devices found\",\n");
-                    printf("    \"devices\": []\n");
-                    printf("}\n");
-                    hid_exit();
-                    return 1;
-                }
-                printf("{\n  \"devices\": [\n");
-                bool first = true;
-                cur_dev = devs;
-                while (cur_dev) {
-                    if( (!usage_page || cur_dev->usage_page == usage_page) &&
-                        (!usage     || cur_dev->usage      == usage)       &&
-                        (serial_wstr[0]==L'\0' || wcscmp(cur_dev->serial_number, serial_wstr)==0) ) {
-                        if (!first) printf(",\n");
-                        first = false;
-                        printf("    {\n");
-                        printf("      \"vendor_id\": \"0x%04hX\",\n", cur_dev->vendor_id);
-                        printf("      \"product_id\": \"0x%04hX\",\n", cur_dev->product_id);
-                        printf("      \"usage_page\": \"0x%04hX\",\n", cur_dev->usage_page);
-                        printf("      \"usage\": \"0x%04hX\",\n", cur_dev->usage);
-                        printf("      \"manufacturer_string\": "); json_print_wstr(cur_dev->manufacturer_string); printf(",\n");
-                        printf("      \"product_string\": ");      json_print_wstr(cur_dev->product_string);      printf(",\n");
-                        printf("      \"serial_number\": ");       json_print_wstr(cur_dev->serial_number);       printf(",\n");
-                        printf("      \"interface_number\": %d,\n", cur_dev->interface_number);
-                        printf("      \"bus_type\": \"%d\",\n", cur_dev->bus_type);
-                        printf("      \"bus_type_name\": \"%s\",\n", bus_type_name(cur_dev->bus_type));
-                        printf("      \"path\": "); json_print_str(cur_dev->path); printf("\n");
-                        printf("    }");
-                    }
-                    cur_dev = cur_dev->next;
-                }
-                printf("\n  ]\n}\n");
-                hid_free_enumeration(devs);
-            }
-            else if( cmd == CMD_OPEN ) {
-                if( vid && pid && !usage_page && !usage ) {
-                    msg("Opening device, vid/pid: 0x%04X/0x%04X\n",vid,pid);
-                    dev = hid_open(vid,pid,NULL);
-                }
-                else {
-                    msg("Opening device, vid/pid:0x%04X/0x%04X, usagePage/usage: %X/%X\n",
-                        vid,pid,usage_page,usage);
-
-                    struct hid_device_info *devs, *cur_dev;
-                    devs = hid_enumerate(vid, pid); // 0,0 = find all devices
-                    if (!devs) {
-                        msg("Error: no HID devices found for given vid/pid\n");
-                        hid_exit();
-                        return 1;
-                    }
-                    cur_dev = devs;
-                    while (cur_dev) {
-                        msginfo("Device found: path: %s, vid: 0x%04X, pid: 0x%04X, usage_page: 0x%04X, usage: 0x%04X\n",
-                            cur_dev->path,
-                            cur_dev->vendor_id,
-                            cur_dev->product_id,
-                            cur_dev->usage_page,
-                            cur_dev->usage);
-
-                        if( (!vid || cur_dev->vendor_id == vid) &&
-                            (!pid || cur_dev->product_id == pid) &&
-                            (!usage_page || cur_dev->usage_page == usage_page) &&
-                            (!usage || cur_dev->usage == usage) &&
-                            (serial_wstr[0]==L'\0' || wcscmp(cur_dev->serial_number, serial_wstr)==0) ) {
-                            strncpy(devpath, cur_dev->path, MAX_STR); // save it!
-                        }
-                        cur_dev = cur_dev->next;
-                    }
-                    hid_free_enumeration(devs);
-
-                    if( devpath[0] ) {
-                        msginfo("Opening device by path: %s\n",devpath);
-                        hid_device *handle = hid_open_path(devpath);
-                        if (!handle) {
-                            msg("Error: could not open device at path: %s\n",devpath);
-                            msg("Error: %ls\n", hid_error(handle));
-                            hid_exit();
-                            return 1;
-                        }
-                        dev = handle;
-                        msg("Device opened\n");
-                    }
-                    else {
-                        msg("Error: no matching devices\n");
-                    }
-                }
-            }
-            else if( cmd == CMD_OPEN_PATH ) {
+/**
+ * One parsed command-line command, with its argument pre-parsed
+ */
+typedef struct {
+    int cmd;          // one of CMD_*
+    char* arg;        // option argument as given, if any
+    int num;          // pre-parsed number (reportId, vid, usagePage, width, ...)
+    int num2;         // second pre-parsed number (pid)
+    int buflen;       // report length in effect for this command
+    uint8_t* data;    // pre-parsed, zero-padded payload of 'buflen' bytes (--send-*)
+} command_t;
 
-                msg("Opening device. path: %s\n",optarg);
-                dev = hid_open_path(optarg);
-                if( dev==NULL ) {
-                    msg("Error: could not open device\n");
-                }
-            }
-            else if( cmd == CMD_CLOSE ) {
+command_t* plan = NULL;   // commands in the order given on the command line
+int plan_len = 0;
+int repeat_count = 1;         // "--repeat", times to run the plan
+double repeat_seconds = 0;    // "--repeat-for", or 0 if unused
 
-                msg("Closing device\n");
-                if(dev) {
-                    hid_close(dev);
-                    dev = NULL;
-                }
-            }
-            else if( cmd == CMD_GET_REPORT_DESCRIPTOR ) {
-                if( !dev ) {
-                    msg("Error on send: no device opened.\n"); break;
-                }
-                msg("Report Descriptor:\n");
-                int descriptorLen = hid_get_report_descriptor(dev, descriptorBuf,
-                                                              HID_API_MAX_REPORT_DESCRIPTOR_SIZE);
-                printbuf(descriptorBuf, descriptorLen, print_base, print_width);
-            }
-            else if( cmd == CMD_SEND_OUTPUT  ||
-                     cmd == CMD_SEND_FEATURE ) {
+// state while running the plan, reset at the start of every iteration
+hid_device *dev = NULL;   // HIDAPI device we will open
+uint8_t buf[MAX_BUF];     // data buffer for recv
+int timeout_millis = 250;
+uint16_t vid = 0;         // vendorId
+uint16_t pid = 0;         // productId
+uint16_t usage_page = 0;  // usagePage to search for, if any
+uint16_t usage = 0;       // usage to search for, if any
+wchar_t serial_wstr[MAX_STR/4] = {L'\0'}; // serial number string rto search for, if any
+char devpath[MAX_STR];    // path to open, if filter by usage
+unsigned char descriptorBuf[HID_API_MAX_REPORT_DESCRIPTOR_SIZE];
 
-                int parsedlen = str2buf(buf, ", ", optarg, sizeof(buf), 1);
-                if( parsedlen<1 ) { // no bytes or error
-                    msg("Error: no bytes read as arg to --send...");
-                    break;
-                }
-                buflen = (!buflen) ? parsedlen : buflen;
+/**
+ * Histogram of values (usually microseconds) with log-linear buckets,
+ * 16 per power of two so about 6% resolution, plus running mean/variance.
+ * Fixed size, so adding a value never allocates.
+ */
+#define HIST_BUCKETS 640
 
-                if( !dev ) {
-                    msg("Error on send: no device opened.\n"); break;
-                }
-                if( cmd == CMD_SEND_OUTPUT ) {
-                    msg("Writing output report of %d-bytes...",buflen);
-                    res = hid_write(dev, buf, buflen);
-                }
-                else {
-                    msg("Writing %d-byte feature report...",buflen);
-                    res = hid_send_feature_report(dev, buf, buflen);
-                }
-                if( res < 0 ) {
-                    msg("error: %ls\n", hid_error(dev));
-                } else { 
-                    msg("wrote %d bytes:\n", res);
-                }
-                if(!msg_quiet) { printbuf(buf, buflen, print_base, print_width); }
-            }
-            else if( cmd == CMD_READ_INPUT ||
-                     cmd == CMD_READ_INPUT_FOREVER ) {
-
-                if( !dev ) {
-                    msg("Error on read: no device opened.\n"); break;
-                }
-                if( !buflen) {
-                    msg("Error on read: buffer length is 0. Use --len to specify.\n"); break;
-                }
-                do {
-                    msg("Reading up to %d-byte input report, %d msec timeout...",
-                      buflen, timeout_millis);
-                    res = hid_read_timeout(dev, buf, buflen, timeout_millis);
-                    msg("read %d bytes:\n", res);
-                    if( res < 0 ) {  // error or removed device
-                        msg("error: %ls\n", hid_error(dev));
-                        cmd = CMD_CLOSE;
-                        break;
-                    } else { 
-                        printbuf(buf,buflen, print_base, print_width);
-                        memset(buf,0,buflen);  // clear it out
-                    }
-                } while( cmd == CMD_READ_INPUT_FOREVER );
-            }
-            else if( cmd == CMD_READ_INPUT_REPORT ||
-                     cmd == CMD_READ_INPUT_REPORT_FOREVER ) {
-                if( !dev ) {
-                    msg("Error on read: no device opened.\n"); break;
-                }
-                if( !buflen) {
-                    msg("Error on read: buffer length is 0. Use --len to specify.\n");
-                    break;
-                }
-                uint8_t report_id = (optarg) ? strtol(optarg,NULL,0) : 0;
-                do {
-                    memset(buf, 0, MAX_BUF);
-                    buf[0] = report_id;
-                    msg("Reading %d-byte input report using hid_get_input_report, report_id %d...",
-                        buflen, report_id);
-                    res = hid_get_input_report(dev, buf, buflen);
-                    if( res < 0 ) {
-                        msg("error: %ls\n", hid_error(dev));
-                    } else { 
-                        msg("read %d bytes:\n",res);
-                        printbuf(buf, buflen, print_base, print_width);
-                    }
-                    // since input report is non-blocking, use timeout_millis
-                    sleep_ms(timeout_millis);
-                } while( cmd == CMD_READ_INPUT_REPORT_FOREVER );
-            }
-            else if( cmd == CMD_READ_FEATURE ) {
+typedef struct {
+    uint64_t count;
+    double mean;          // Welford running mean ...
+    double m2;            // ... and sum of squared differences
+    uint64_t min;
+    uint64_t max;
+    uint32_t buckets[HIST_BUCKETS];
+} histogram_t;
 
-                if( !dev ) {
-                    msg("Error on read: no device opened.\n"); break;
-                }
-                if( !buflen) {
-                    msg("Error on read: buffer length is 0. Use --len to specify.\n");
-                    break;
-                }
-                uint8_t report_id = (optarg) ? strtol(optarg,NULL,0) : 0;
-                memset(buf, 0, MAX_BUF);
-                buf[0] = report_id;
-                msg("Reading %d-byte feature report, report_id %d...",buflen, report_id);
-                res = hid_get_feature_report(dev, buf, buflen);
-                if( res <  0 ){
-                    msg("error: %ls\n", hid_error(dev));
-                } else { 
-                    msg("read %d bytes:\n",res);
-                    printbuf(buf, buflen, print_base, print_width);
-                }
-            }
-            else if( cmd == CMD_VERSION ) {
-                printf("hidapitester version: %s\n", HIDAPITESTER_VERSION);
-                printf("hidapi version: %d.%d.%d\n",
-                       HID_API_VERSION_MAJOR, HID_API_VERSION_MINOR, HID_API_VERSION_PATCH);
-            }
+int hist_bucket(uint64_t v)
+{
+    if( v < 32 ) return (int)v;
+    int e = 0;
+    while( (v >> e) >= 32 ) e++;     // v>>e is now 16..31
+    int b = (e+1)*16 + (int)(v >> e) - 16;
+    return (b < HIST_BUCKETS) ? b : HIST_BUCKETS-1;
+}
 
-            break; // case 0 (longopts without shortops)
-        case 'h':
-            print_usage("hidapitester");
-            break;
-        case 'l':
-            buflen = strtol(optarg,NULL,10);
-            msginfo("Set buflen to %d\n", buflen);
-            break;
-        case 't':
-            timeout_millis = strtol(optarg,NULL,10);
-            msginfo("Set timeout_millis to %d\n", timeout_millis);
-            break;
-        case 'b':
-            print_base = strtol(optarg,NULL,10);
-            msginfo("Set print_base to %d\n", print_base);
-            break;
-        case 'w':
-            print_width = strtol(optarg,NULL,10);
-            msginfo("Set print_width to %d\n", print_width);
+/**
+ * middle of the range of values that land in bucket 'b'
+ */
+uint64_t hist_bucket_value(int b)
+{
+    if( b < 32 ) return b;
+    int e = b/16 - 1;
+    uint64_t lo = (uint64_t)(b%16 + 16) << e;
+    return lo + ((1ull << e) >> 1);
+}
 
-            if (print_width <= 0) {
+void hist_add(histogram_t* h, uint64_t v)
+{
+    if( h->count == 0 || v < h->min ) h->min = v;
+    if( v > h->max ) h->max = v;
+    h->count++;
+    double delta = v - h->mean;
+    h->mean += delta / h->count;
+    h->m2 += delta * (v - h->mean);
+    h->buckets[hist_bucket(v)]++;
+}
+
+double hist_stddev(histogram_t* h)
+{
+    return (h->count > 1) ? sqrt(h->m2 / (h->count - 1)) : 0;
+}
+
+/**
+ * Approximate value below which 'pct' percent of the values fall
+ */
+uint64_t hist_percentile(histogram_t* h, double pct)
+{
+    uint64_t want = (uint64_t)(h->count * pct / 100.0);
+    uint64_t seen = 0;
+    for( int b=0; b<HIST_BUCKETS; b++ ) {
+        seen += h->buckets[b];
+        if( seen > want ) {
+            uint64_t v = hist_bucket_value(b);
+            return (v < h->min) ? h->min : (v > h->max) ? h->max : v;
+        }
+    }
+    return h->max;
+}
+
+/**
+ * "--timestamps": arrival time of each input report and the
+ * distribution of intervals between them
+ */
+typedef struct {
+    bool enabled;
+    uint64_t late_usec;     // flag intervals longer than this, 0 = don't
+    uint64_t first_ns;      // arrival of first report
+    uint64_t last_ns;       // arrival of latest report
+    uint64_t interval_ns;   // time between latest report and the one before
+    bool last_late;
+    uint64_t late;          // number of late reports
+    histogram_t intervals;  // in usec
+} arrivals_t;
+
+arrivals_t arrivals;
+
+void arrivals_track(uint64_t t)
+{
+    if( !arrivals.enabled ) return;
+    if( !arrivals.first_ns ) {
+        arrivals.first_ns = arrivals.last_ns = t;
+        arrivals.interval_ns = 0;
+        return;
+    }
+    arrivals.interval_ns = t - arrivals.last_ns;
+    arrivals.last_ns = t;
+    uint64_t usec = arrivals.interval_ns / 1000;
+    hist_add(&arrivals.intervals, usec);
+    arrivals.last_late = arrivals.late_usec && usec > arrivals.late_usec;
+    if( arrivals.last_late ) arrivals.late++;
+}
+
+void arrivals_print_stats(void)
+{
+    histogram_t* h = &arrivals.intervals;
+    printf("Timing: %llu intervals over %.3f s, mean %.3f ms, stddev %.3f ms, min %.3f ms, max %.3f ms\n",
+           (unsigned long long)h->count, (arrivals.last_ns - arrivals.first_ns) / 1e9,
+           h->mean / 1e3, hist_stddev(h) / 1e3, h->min / 1e3, h->max / 1e3);
+    printf("Timing: p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, p99.9 %.3f ms",
+           hist_percentile(h, 50) / 1e3, hist_percentile(h, 90) / 1e3,
+           hist_percentile(h, 99) / 1e3, hist_percentile(h, 99.9) / 1e3);
+    if( arrivals.late_usec ) {
+        printf(", %llu late (> %.3f ms)", (unsigned long long)arrivals.late, arrivals.late_usec / 1e3);
+    }
+    printf("\n");
+}
+
+/**
+ * "--expect" and "--test-spec": check the bytes of the last report read,
+ * and group commands into timed, pass/fail steps
+ */
+uint8_t last_report[MAX_BUF];   // last Input or Feature report read
+int last_report_len = -1;       // its length, 0 on timeout, -1 on error or none yet
+int expect_failures = 0;        // failed "--expect" checks
+int op_errors = 0;              // failed opens, sends and reads
+
+typedef struct {
+    const char* name;       // "file:line: args", or "--step" argument
+    int runs;
+    int failed;
+    uint64_t total_ns;
+} step_t;
+
+step_t* steps = NULL;       // one per "--step", in plan order
+int steps_len = 0;
+int step_current = -1;      // step running now, -1 if none
+uint64_t step_start_ns;
+int step_start_failures;    // expect_failures + op_errors when step started
+
+void last_report_save(uint8_t* report, int len)
+{
+    last_report_len = len;
+    if( len > 0 ) { memcpy(last_report, report, len); }
+}
+
+/**
+ * Compare 'count' bytes of 'data' with the last report at 'offset'.
+ * Returns true if they all match
+ */
+bool expect_check(int offset, uint8_t* data, int count, const char* spec)
+{
+    if( last_report_len <= 0 ) {
+        printf("Expect %s: FAIL, no report was read\n", spec);
+        expect_failures++;
+        return false;
+    }
+    for( int i=0; i<count; i++ ) {
+        if( offset + i >= last_report_len || last_report[offset + i] != data[i] ) {
+            printf("Expect %s: FAIL at offset %d, got", spec, offset + i);
+            for( int j=offset; j < offset + count && j < last_report_len; j++ ) {
+                printf(" %02X", last_report[j]);
+            }
+            printf(" (report is %d bytes)\n", last_report_len);
+            expect_failures++;
+            return false;
+        }
+    }
+    msg("Expect %s: PASS\n", spec);
+    return true;
+}
+
+/**
+ * End the running step, if any. A step fails if an expect or an
+ * open/send/read in it failed, or if it stopped the plan ('aborted')
+ */
+void step_finish(bool aborted)
+{
+    if( step_current < 0 ) return;
+    step_t* s = &steps[step_current];
+    uint64_t ns = now_nsec() - step_start_ns;
+    bool failed = aborted || (expect_failures + op_errors) > step_start_failures;
+    s->runs++;
+    s->failed += failed;
+    s->total_ns += ns;
+    printf("Step %s: %s (%.3f ms)\n", s->name, failed ? "FAIL" : "PASS", ns / 1e6);
+    step_current = -1;
+}
+
+void step_begin(int n)
+{
+    step_finish(false);
+    step_current = n;
+    step_start_failures = expect_failures + op_errors;
+    step_start_ns = now_nsec();
+}
+
+int steps_print_summary(void)
+{
+    int runs = 0, failed = 0;
+    uint64_t ns = 0;
+    for( int i=0; i<steps_len; i++ ) {
+        runs += steps[i].runs;
+        failed += steps[i].failed;
+        ns += steps[i].total_ns;
+    }
+    printf("Test: %d of %d steps passed, %d failed (%.3f ms)\n", runs - failed, runs, failed, ns / 1e6);
+    for( int i=0; i<steps_len; i++ ) {
+        if( steps[i].failed ) {
+            printf("Test: failed %d time%s: %s\n", steps[i].failed, steps[i].failed == 1 ? "" : "s",
+                   steps[i].name);
+        }
+    }
+    return failed;
+}
+
+/**
+ * Split 'line' into whitespace-separated args, with "double quotes"
+ * for args containing spaces. Modifies 'line'. Returns number of args,
+ * or -1 if there are more than 'max'
+ */
+int split_args(char* line, char** args, int max)
+{
+    int n = 0;
+    char* p = line;
+    while( n < max ) {
+        while( *p == ' ' || *p == '\t' ) p++;
+        if( !*p ) break;
+        if( *p == '"' ) {
+            args[n++] = ++p;
+            while( *p && *p != '"' ) p++;
+        } else {
+            args[n++] = p;
+            while( *p && *p != ' ' && *p != '\t' ) p++;
+        }
+        if( *p ) *p++ = '\0';
+    }
+    while( *p == ' ' || *p == '\t' ) p++;
+    return *p ? -1 : n;
+}
+
+/**
+ * For each argument after spec_expand(), the "file:line: text" of the
+ * test spec line it came from, or NULL if it was on the command line
+ */
+char** spec_origin = NULL;
+
+#define SPEC_MAX_ARGS 64    // arguments on one test spec line
+
+/**
+ * "--test-spec <file>": each line of the file is one step, written as
+ * hidapitester arguments (blank lines and #comments are skipped), e.g.
+ *
+ *   --vidpid 27b8:4444 -l 9 --open
+ *   --send-feature 1,99,44,22
+ *   --read-feature 1 --expect 1:0x61,0x62,0x63,0x64
+ *
+ * The file is expanded into argv before parsing, each line becoming
+ * "--step <file:line: text>" followed by its arguments, so the whole
+ * suite runs in one process over one open device.
+ * Returns 0, or -1 if a spec file couldn't be read or has a line that is
+ * too long or has too many arguments
+ */
+int spec_expand(int* argcp, char*** argvp)
+{
+    int argc = *argcp;
+    char** argv = *argvp;
+    int cap = argc + 1, n = 0;
+    char** out = malloc(cap * sizeof(char*));
+    char** origin = calloc(cap, sizeof(char*));
+    bool expanded = false;
+
+    for( int i=0; i<argc; i++ ) {
+        const char* file = NULL;
+        if( i > 0 && strcmp(argv[i], "--test-spec") == 0 && i+1 < argc ) { file = argv[++i]; }
+        else if( i > 0 && strncmp(argv[i], "--test-spec=", 12) == 0 ) { file = argv[i] + 12; }
+        if( !file ) {
+            if( n + 1 >= cap ) {
+                cap *= 2;
+                out = realloc(out, cap * sizeof(char*));
+                origin = realloc(origin, cap * sizeof(char*));
+            }
+            origin[n] = NULL;
+            out[n++] = argv[i];
+            continue;
+        }
+        FILE* fp = fopen(file, "r");
+        if( !fp ) {
+            msg("Error: could not open test spec '%s': %s\n", file, strerror(errno));
+            free(out);
+            free(origin);
+            return -1;
+        }
+        expanded = true;
+        char line[MAX_STR*4];
+        int lineno = 0;
+        const char* bad = NULL;
+        while( fgets(line, sizeof(line), fp) ) {
+            lineno++;
+            if( !strchr(line, '\n') && !feof(fp) ) {
+                bad = "line too long";
+                break;
+            }
+            line[strcspn(line, "\r\n")] = '\0';
+            char* text = line + strspn(line, " \t");
+            if( !*text || *text == '#' ) continue;
+            size_t namelen = strlen(file) + strlen(text) + 16;
+            char* name = malloc(namelen);
+            snprintf(name, namelen, "%s:%d: %s", file, lineno, text);
+            char* args[SPEC_MAX_ARGS];
+            int nargs = split_args(strdup(text), args, SPEC_MAX_ARGS);
+            if( nargs < 0 ) {
+                bad = "too many arguments";
+                break;
+            }
+            if( n + nargs + 3 >= cap ) {
+                cap = 2 * (n + nargs + 3);
+                out = realloc(out, cap * sizeof(char*));
+                origin = realloc(origin, cap * sizeof(char*));
+            }
+            for( int a=0; a<nargs+2; a++ ) { origin[n+a] = name; }
+            out[n++] = "--step";
+            out[n++] = name;
+            for( int a=0; a<nargs; a++ ) { out[n++] = args[a]; }
+        }
+        fclose(fp);
+        if( bad ) {
+            msg("Error: test spec line failed to parse: %s:%d: %s\n", file, lineno, bad);
+            free(out);
+            free(origin);
+            return -1;
+        }
+    }
+    out[n] = NULL;
+    if( !expanded ) {
+        free(out);
+        free(origin);
+        return 0;
+    }
+    *argcp = n;
+    *argvp = out;   // kept for the life of the process, like argv
+    spec_origin = origin;
+    return 0;
+}
+
+/**
+ * "--summarize": instead of printing every input report, keep running
+ * min/max/mean/variance of each byte (or of each Input field, when the
+ * report descriptor is known) and print one line per tumbling window
+ */
+#define MAX_FIELDS 256
+
+typedef struct {
+    uint8_t id;             // reportId of the report the field is in
+    uint32_t bit;           // bit offset in report, after any reportId byte
+    uint8_t size;           // bits, 1 to 32
+    bool is_signed;
+} field_t;
+
+typedef struct {
+    uint64_t n;
+    int64_t min;
+    int64_t max;
+    double mean;            // Welford running mean ...
+    double m2;              // ... and sum of squared differences
+} summary_col_t;
+
+typedef struct {
+    bool enabled;
+    uint64_t window_ns;
+    uint64_t first_ns;      // time of first report, 0 if none yet
+    uint64_t window_start;
+    uint64_t reports;       // reports in this window
+    bool ids;               // reports start with a reportId byte
+    int nfields;            // 0 = summarize each byte
+    field_t fields[MAX_FIELDS];
+    summary_col_t cols[MAX_BUF];
+} summary_t;
+
+summary_t summary;
+
+static inline void summary_add(summary_col_t* c, int64_t v)
+{
+    if( c->n == 0 || v < c->min ) c->min = v;
+    if( c->n == 0 || v > c->max ) c->max = v;
+    c->n++;
+    double d = v - c->mean;
+    c->mean += d / c->n;
+    c->m2 += d * (v - c->mean);
+}
+
+/**
+ * Value of field 'f' in 'report', or false if report is too short
+ */
+static bool field_value(field_t* f, uint8_t* report, int len, bool ids, int64_t* v)
+{
+    uint32_t bit = f->bit + (ids ? 8 : 0);
+    uint32_t first = bit / 8, last = (bit + f->size - 1) / 8;
+    if( (int)last >= len ) return false;
+    uint64_t raw = 0;
+    for( uint32_t i=first; i<=last; i++ ) raw |= (uint64_t)report[i] << (8 * (i - first));
+    raw = (raw >> (bit % 8)) & ((1ull << f->size) - 1);
+    if( f->is_signed && (raw >> (f->size - 1)) & 1 ) {
+        *v = (int64_t)raw - (int64_t)(1ull << f->size);
+    } else {
+        *v = (int64_t)raw;
+    }
+    return true;
+}
+
+void summary_print(bool partial)
+{
+    int ncols = summary.nfields ? summary.nfields : MAX_BUF;
+    double start = (summary.window_start - summary.first_ns) / 1e9;
+    printf("Summary %.3f-%.3f s: %llu reports%s", start, start + summary.window_ns / 1e9,
+           (unsigned long long)summary.reports, partial ? " (partial)" : "");
+    for( int i=0; i<ncols; i++ ) {
+        summary_col_t* c = &summary.cols[i];
+        if( !c->n ) continue;
+        printf(" | %c%d %lld/%lld/%.2f/%.2f", summary.nfields ? 'f' : 'b', i, (long long)c->min,
+               (long long)c->max, c->mean, c->n > 1 ? c->m2 / (c->n - 1) : 0.0);
+    }
+    printf("\n");
+    summary.reports = 0;
+    memset(summary.cols, 0, sizeof(summary.cols));
+}
+
+void summary_track(uint8_t* report, int len, uint64_t t)
+{
+    if( !summary.enabled ) return;
+    if( !summary.first_ns ) {
+        summary.first_ns = summary.window_start = t;
+    }
+    if( t - summary.window_start >= summary.window_ns ) {  // window over
+        if( summary.reports ) { summary_print(false); }
+        summary.window_start += (t - summary.window_start) / summary.window_ns * summary.window_ns;
+    }
+    summary.reports++;
+    if( summary.nfields ) {
+        for( int i=0; i<summary.nfields; i++ ) {
+            field_t* f = &summary.fields[i];
+            int64_t v;
+            if( summary.ids && f->id != report[0] ) continue;
+            if( field_value(f, report, len, summary.ids, &v) ) { summary_add(&summary.cols[i], v); }
+        }
+    } else {
+        for( int i=0; i<len; i++ ) { summary_add(&summary.cols[i], report[i]); }
+    }
+}
+
+static int make_dir(const char* path)
+{
+#ifdef _WIN32
+    return _mkdir(path);
+#else
+    return mkdir(path, 0755);
+#endif
+}
+
+/**
+ * "--split-by-report-id": write each input report to a file chosen by
+ * its first byte (the reportId), instead of printing it.  Files are
+ * opened on the first report with that ID and written through their
+ * own large buffer, in the "--send-output-file" formats
+ */
+#define SPLIT_IOBUF_SIZE (64*1024)
+
+typedef struct {
+    FILE* fp;
+    char* iobuf;
+    bool failed;            // couldn't open, don't keep trying
+    uint64_t reports;
+    uint64_t bytes;
+    uint64_t write_errors;
+    uint64_t first_ns;
+    uint64_t last_ns;
+} split_sink_t;
+
+typedef struct {
+    bool enabled;
+    bool binary;            // raw records, else hex lines
+    char pattern[MAX_STR];  // printf() pattern for the reportId, or a directory
+    bool is_dir;
+    split_sink_t sinks[256];
+} split_t;
+
+split_t split;
+
+void split_sink_path(char* path, size_t size, uint8_t id)
+{
+    if( split.is_dir ) {
+        snprintf(path, size, "%s/report-%02x.%s", split.pattern, id, split.binary ? "bin" : "hex");
+    } else {
+        snprintf(path, size, split.pattern, id);
+    }
+}
+
+/**
+ * Pattern must have exactly one %d, %u, %x or %X (with optional
+ * flags and width) for the reportId, plus any number of "%%"
+ */
+static bool split_pattern_ok(const char* p)
+{
+    int conversions = 0;
+    for( ; *p; p++ ) {
+        if( *p != '%' ) continue;
+        if( p[1] == '%' ) { p++; continue; }
+        p++;
+        while( *p == '0' || *p == '-' || *p == '#' ) p++;
+        while( *p >= '0' && *p <= '9' ) p++;
+        if( *p != 'd' && *p != 'u' && *p != 'x' && *p != 'X' ) return false;
+        conversions++;
+    }
+    return conversions == 1;
+}
+
+/**
+ * Flush and close every file, printing what went to each
+ */
+void split_close(void)
+{
+    if( !split.enabled ) return;
+    for( int id=0; id<256; id++ ) {
+        split_sink_t* s = &split.sinks[id];
+        if( !s->fp ) continue;
+        if( fclose(s->fp) != 0 ) s->write_errors++;
+        free(s->iobuf);
+        char path[MAX_STR+16];
+        split_sink_path(path, sizeof(path), id);
+        double secs = (s->last_ns - s->first_ns) / 1e9;
+        printf("Split: reportId %d: %llu reports, %llu bytes, %.1f reports/sec, %llu write errors -> %s\n",
+               id, (unsigned long long)s->reports, (unsigned long long)s->bytes,
+               (secs > 0) ? (s->reports - 1) / secs : 0.0, (unsigned long long)s->write_errors, path);
+    }
+    memset(&split, 0, sizeof(split));
+}
+
+/**
+ * Start splitting reports into 'pattern' (a directory, or a file
+ * pattern with a %d/%x for the reportId). Returns 0, or -1 on error
+ */
+int split_open(const char* pattern, bool binary)
+{
+    if( split.enabled && strcmp(pattern, split.pattern) == 0 ) return 0;  // "--repeat"
+    split_close();
+    split.is_dir = (strchr(pattern, '%') == NULL);
+    if( split.is_dir && make_dir(pattern) != 0 && errno != EEXIST ) {
+        msg("Error: could not create directory '%s': %s\n", pattern, strerror(errno));
+        return -1;
+    }
+#ifndef _WIN32
+    signal(SIGPIPE, SIG_IGN);  // a FIFO reader going away is a write error, not the end
+#endif
+    strcpy(split.pattern, pattern);
+    split.binary = binary;
+    split.enabled = true;
+    return 0;
+}
+
+void split_track(uint8_t* report, int len, uint64_t t)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    if( !split.enabled ) return;
+    split_sink_t* s = &split.sinks[report[0]];
+    if( !s->fp ) {
+        if( s->failed ) return;
+        char path[MAX_STR+16];
+        split_sink_path(path, sizeof(path), report[0]);
+        s->fp = fopen(path, split.binary ? "wb" : "w");  // blocks on a FIFO until it has a reader
+        if( !s->fp ) {
+            msg("Error: could not open '%s' for reportId %d: %s\n", path, report[0], strerror(errno));
+            s->failed = true;
+            return;
+        }
+        s->iobuf = malloc(SPLIT_IOBUF_SIZE);
+        setvbuf(s->fp, s->iobuf, _IOFBF, SPLIT_IOBUF_SIZE);
+        s->first_ns = t;
+    }
+    s->reports++;
+    s->bytes += len;
+    s->last_ns = t;
+    size_t n;
+    if( split.binary ) {
+        n = fwrite(report, 1, len, s->fp);
+        if( n != (size_t)len ) s->write_errors++;
+    } else {
+        char line[MAX_BUF*3 + 1];
+        char* p = line;
+        for( int i=0; i<len; i++ ) {
+            *p++ = hex[report[i] >> 4];
+            *p++ = hex[report[i] & 0xf];
+            *p++ = ' ';
+        }
+        p[-1] = '\n';
+        n = fwrite(line, 1, p - line, s->fp);
+        if( n != (size_t)(p - line) ) s->write_errors++;
+    }
+}
+
+/**
+ * "--verify-crc <algo:start-end:offset[:be]>": check the CRC or checksum
+ * each input report carries at 'offset' against one computed over bytes
+ * 'start' to 'end' (inclusive).  CRCs are table-driven, one lookup per byte
+ */
+enum { CRC_8, CRC_16, CRC_32, CRC_SUM };
+
+typedef struct {
+    bool enabled;
+    bool failures_only;     // "--crc-failures-only", print only bad reports
+    int algo;               // CRC_*
+    int start, end;         // bytes covered, inclusive
+    int offset;             // where the report keeps its CRC
+    bool big_endian;        // CRC stored most significant byte first
+    bool last_ok;           // result for the latest report
+    bool last_short;        // ... which was too short to check
+    uint32_t last_got, last_want;
+    uint64_t valid, invalid, short_reports;
+    uint8_t table8[256];
+    uint16_t table16[256];
+    uint32_t table32[256];
+} crc_t;
+
+crc_t crc;
+
+static const char* crc_names[] = { "crc8", "crc16", "crc32", "sum" };
+static const int crc_sizes[] = { 1, 2, 4, 1 };  // bytes the CRC takes in the report
+
+/**
+ * Parse "algo:start-end:offset[:be]" into 'c'. Returns false if malformed
+ */
+bool crc_parse(const char* spec, crc_t* c)
+{
+    char name[8], order[4] = "le";
+    int n = sscanf(spec, "%7[^:]:%d-%d:%d:%3s", name, &c->start, &c->end, &c->offset, order);
+    if( n < 4 ) return false;
+    c->algo = -1;
+    for( int i=0; i<4; i++ ) {
+        if( strcmp(name, crc_names[i]) == 0 ) c->algo = i;
+    }
+    c->big_endian = (strcmp(order, "be") == 0);
+    return c->algo >= 0 && c->start >= 0 && c->start <= c->end && c->end < MAX_BUF &&
+           c->offset >= 0 && c->offset + crc_sizes[c->algo] <= MAX_BUF &&
+           (c->big_endian || strcmp(order, "le") == 0);
+}
+
+/**
+ * CRC-8 (poly 0x07), CRC-16/CCITT (poly 0x1021, init 0xFFFF),
+ * CRC-32 (IEEE 802.3, as in zlib)
+ */
+void crc_init_tables(crc_t* c)
+{
+    for( int i=0; i<256; i++ ) {
+        uint8_t c8 = i;
+        uint16_t c16 = i << 8;
+        uint32_t c32 = i;
+        for( int b=0; b<8; b++ ) {
+            c8  = (c8 & 0x80) ? (c8 << 1) ^ 0x07 : (c8 << 1);
+            c16 = (c16 & 0x8000) ? (c16 << 1) ^ 0x1021 : (c16 << 1);
+            c32 = (c32 & 1) ? (c32 >> 1) ^ 0xEDB88320 : (c32 >> 1);
+        }
+        c->table8[i] = c8;
+        c->table16[i] = c16;
+        c->table32[i] = c32;
+    }
+}
+
+uint32_t crc_compute(crc_t* c, const uint8_t* p, int len)
+{
+    uint32_t v;
+    switch( c->algo ) {
+    case CRC_8:
+        v = 0;
+        for( int i=0; i<len; i++ ) v = c->table8[v ^ p[i]];
+        return v;
+    case CRC_16:
+        v = 0xFFFF;
+        for( int i=0; i<len; i++ ) v = ((v << 8) ^ c->table16[(v >> 8) ^ p[i]]) & 0xFFFF;
+        return v;
+    case CRC_32:
+        v = 0xFFFFFFFF;
+        for( int i=0; i<len; i++ ) v = c->table32[(v ^ p[i]) & 0xFF] ^ (v >> 8);
+        return ~v;
+    default:
+        v = 0;
+        for( int i=0; i<len; i++ ) v += p[i];
+        return v & 0xFF;
+    }
+}
+
+void crc_track(uint8_t* report, int len)
+{
+    crc.last_ok = true;
+    if( !crc.enabled || len <= 0 ) return;
+    int size = crc_sizes[crc.algo];
+    if( crc.end >= len || crc.offset + size > len ) {
+        crc.short_reports++;
+        crc.last_ok = false;
+        crc.last_short = true;
+        return;
+    }
+    uint32_t got = 0;
+    for( int i=0; i<size; i++ ) {
+        int b = crc.big_endian ? i : size - 1 - i;
+        got = (got << 8) | report[crc.offset + b];
+    }
+    uint32_t want = crc_compute(&crc, report + crc.start, crc.end - crc.start + 1);
+    crc.last_ok = (got == want);
+    crc.last_short = false;
+    crc.last_got = got;
+    crc.last_want = want;
+    if( crc.last_ok ) crc.valid++;
+    else crc.invalid++;
+}
+
+void crc_print_stats(void)
+{
+    printf("CRC: %s over bytes %d-%d at %d: %llu valid, %llu invalid, %llu too short\n",
+           crc_names[crc.algo], crc.start, crc.end, crc.offset, (unsigned long long)crc.valid,
+           (unsigned long long)crc.invalid, (unsigned long long)crc.short_reports);
+}
+
+/**
+ * Whether the latest input report is printed, rather than summarized,
+ * split, or skipped for having a good CRC
+ */
+bool reports_printed(void)
+{
+    return !summary.enabled && !split.enabled && !(crc.failures_only && crc.last_ok);
+}
+
+/**
+ * Everything done with each input report as it arrives.
+ * 't' is the time the read call returned.
+ */
+void input_report_arrived(uint8_t* report, int len, uint64_t t)
+{
+    last_report_save(report, len);
+    crc_track(report, len);
+    if( len <= 0 ) return;
+    shm_ring_publish(report, len, t);
+    seq_track(report, len);
+    arrivals_track(t);
+    summary_track(report, len, t);
+    split_track(report, len, t);
+}
+
+/**
+ * The "read N bytes:" line before each input report, with arrival time
+ * if "--timestamps" and a mark if "--verify-crc" failed. Shown even when
+ * quiet if timestamps were asked for or the CRC is bad.
+ * Returns number of chars written to 'out', 0 if nothing to show
+ */
+int format_read_header(char* out, int len)
+{
+    if( !reports_printed() ) return 0;
+    char bad[64] = "";
+    if( !crc.last_ok && len > 0 ) {
+        if( crc.last_short ) {
+            strcpy(bad, " CRC BAD (report too short)");
+        } else {
+            sprintf(bad, " CRC BAD (got 0x%X, want 0x%X)", crc.last_got, crc.last_want);
+        }
+    }
+    if( arrivals.enabled && len > 0 ) {
+        return sprintf(out, "read %d bytes at %.6f s (+%.3f ms)%s%s:\n", len,
+                       (arrivals.last_ns - arrivals.first_ns) / 1e9, arrivals.interval_ns / 1e6,
+                       arrivals.last_late ? " LATE" : "", bad);
+    }
+    if( msg_quiet && !bad[0] ) return 0;
+    return sprintf(out, "read %d bytes%s:\n", len, bad);
+}
+
+void print_read_header(int len)
+{
+    char line[128];
+    fwrite(line, 1, format_read_header(line, len), stdout);
+}
+
+/**
+ * "--batch": after a blocking read wakes up, drain every queued input
+ * report non-blocking, then handle and print the whole batch at once
+ */
+int batch_max = 0;      // max reports per wakeup, 0 = not batching
+
+typedef struct {
+    uint64_t wakeups;       // blocking reads that returned a report
+    uint64_t reports;
+    uint64_t max;           // largest batch seen
+    uint64_t sizes[16];     // histogram of batch sizes, log2 buckets
+} batch_stats_t;
+
+batch_stats_t batch_stats;
+
+void batch_print_stats(void)
+{
+    printf("Batch: %llu wakeups, %llu reports, mean %.2f, max %llu reports/wakeup\n",
+           (unsigned long long)batch_stats.wakeups, (unsigned long long)batch_stats.reports,
+           batch_stats.wakeups ? (double)batch_stats.reports / batch_stats.wakeups : 0.0,
+           (unsigned long long)batch_stats.max);
+    printf("Batch sizes:");
+    for( int i=0; i<16; i++ ) {
+        if( batch_stats.sizes[i] ) {
+            printf(" %d-%d:%llu", 1<<i, (2<<i)-1, (unsigned long long)batch_stats.sizes[i]);
+        }
+    }
+    printf("\n");
+}
+
+/**
+ * Does 'd' pass the vid/pid/usagePage/usage/serial filters?
+ */
+bool device_matches(struct hid_device_info* d)
+{
+    return (!vid || d->vendor_id == vid) &&
+           (!pid || d->product_id == pid) &&
+           (!usage_page || d->usage_page == usage_page) &&
+           (!usage || d->usage == usage) &&
+           (serial_wstr[0]==L'\0' || (d->serial_number && wcscmp(d->serial_number, serial_wstr)==0));
+}
+
+/**
+ * Find the path of the last device that passes the filters.
+ * Returns 1 if found, 0 if none match, -1 if there are no devices at all
+ */
+int device_find(char* path)
+{
+    struct hid_device_info *devs, *cur_dev;
+    devs = hid_enumerate(vid, pid); // 0,0 = find all devices
+    if( !devs ) {
+        return -1;
+    }
+    path[0] = '\0';
+    for( cur_dev = devs; cur_dev; cur_dev = cur_dev->next ) {
+        msginfo("Device found: path: %s, vid: 0x%04X, pid: 0x%04X, usage_page: 0x%04X, usage: 0x%04X\n",
+            cur_dev->path,
+            cur_dev->vendor_id,
+            cur_dev->product_id,
+            cur_dev->usage_page,
+            cur_dev->usage);
+        if( device_matches(cur_dev) ) {
+            strncpy(path, cur_dev->path, MAX_STR-1); // save it!
+            path[MAX_STR-1] = '\0';
+        }
+    }
+    hid_free_enumeration(devs);
+    return path[0] ? 1 : 0;
+}
+
+/**
+ * "--reconnect": when a read fails because the device went away, reopen
+ * it rather than stopping.  The path it had is tried first (fast when it
+ * comes straight back, e.g. after a reset), then the filters are
+ * re-resolved, backing off from RECONNECT_MIN_MS to RECONNECT_MAX_MS.
+ */
+#define RECONNECT_MIN_MS 10
+#define RECONNECT_MAX_MS 1000
+
+int reconnect_secs = -1;        // give up after this long, 0 = never, -1 = "--reconnect" not used
+
+typedef struct {
+    int count;                  // successful reconnects
+    uint64_t gap_total_ns;      // time without a device
+    uint64_t gap_max_ns;
+} reconnect_stats_t;
+
+reconnect_stats_t reconnect_stats;
+
+/**
+ * Which interface of which device was opened, so that after an unplug
+ * the same interface of a composite device is found again
+ */
+typedef struct {
+    bool valid;
+    int interface_number;
+    uint16_t usage_page;    // 0 if the platform doesn't say for an open device
+    uint16_t usage;
+} dev_ident_t;
+
+dev_ident_t opened_ident;
+
+/**
+ * Remember the path and interface of newly opened device 'd'
+ */
+void device_remember(hid_device* d)
+{
+    struct hid_device_info* info = hid_get_device_info(d);
+    opened_ident.valid = (info != NULL);
+    if( !info ) return;
+    if( info->path ) {
+        strncpy(devpath, info->path, MAX_STR-1);
+        devpath[MAX_STR-1] = '\0';
+    }
+    opened_ident.interface_number = info->interface_number;
+    opened_ident.usage_page = info->usage_page;
+    opened_ident.usage = info->usage;
+}
+
+static bool same_interface(struct hid_device_info* d)
+{
+    if( !opened_ident.valid ) return true;
+    if( d->interface_number != opened_ident.interface_number ) return false;
+    return !opened_ident.usage_page || !d->usage_page ||
+           (d->usage_page == opened_ident.usage_page && d->usage == opened_ident.usage);
+}
+
+/**
+ * Find the path of the first device that passes the filters and is the
+ * same interface as the one opened before.
+ * Returns 1 if found, 0 if none match, -1 if there are no devices at all
+ */
+int reconnect_find(char* path)
+{
+    struct hid_device_info *devs = hid_enumerate(vid, pid), *cur_dev;
+    if( !devs ) {
+        return -1;
+    }
+    path[0] = '\0';
+    for( cur_dev = devs; cur_dev && !path[0]; cur_dev = cur_dev->next ) {
+        if( device_matches(cur_dev) && same_interface(cur_dev) ) {
+            strncpy(path, cur_dev->path, MAX_STR-1);
+            path[MAX_STR-1] = '\0';
+        }
+    }
+    hid_free_enumeration(devs);
+    return path[0] ? 1 : 0;
+}
+
+/**
+ * Open 'path' if it's still the device and interface we had
+ */
+hid_device* reconnect_try(const char* path)
+{
+    hid_device* d = hid_open_path(path);
+    if( d ) {  // path may now belong to another device, or another interface
+        struct hid_device_info* info = hid_get_device_info(d);
+        if( info && ((vid && !device_matches(info)) || !same_interface(info)) ) {
+            hid_close(d);
+            d = NULL;
+        }
+    }
+    return d;
+}
+
+/**
+ * Close 'lost' and reopen the device, waiting as long as "--reconnect" says.
+ * Returns the new handle (also put in 'dev'), or NULL if we gave up
+ */
+hid_device* device_reconnect(hid_device* lost)
+{
+    char lastpath[MAX_STR];
+    strncpy(lastpath, devpath, MAX_STR);
+    hid_close(lost);
+    dev = NULL;
+
+    uint64_t start = now_nsec();
+    int delay = RECONNECT_MIN_MS;
+    msg("Device lost, reconnecting...\n");
+    while( !stop_requested ) {
+        if( lastpath[0] ) {
+            dev = reconnect_try(lastpath);
+        }
+        if( !dev && reconnect_find(devpath) > 0 ) {
+            dev = reconnect_try(devpath);
+        }
+        if( dev ) {
+            break;
+        }
+        if( reconnect_secs > 0 && now_nsec() - start >= (uint64_t)reconnect_secs * 1000000000ull ) {
+            break;
+        }
+        sleep_ms(delay);
+        delay = (delay * 2 < RECONNECT_MAX_MS) ? delay * 2 : RECONNECT_MAX_MS;
+    }
+    if( !devpath[0] ) { strncpy(devpath, lastpath, MAX_STR); }
+
+    uint64_t gap = now_nsec() - start;  // downtime counts even if we give up
+    reconnect_stats.gap_total_ns += gap;
+    if( gap > reconnect_stats.gap_max_ns ) reconnect_stats.gap_max_ns = gap;
+    if( dev ) {
+        reconnect_stats.count++;
+        printf("Reconnected after %.3f s (reconnect %d)\n", gap / 1e9, reconnect_stats.count);
+    } else {
+        printf("Device did not come back after %.3f s\n", gap / 1e9);
+    }
+    return dev;
+}
+
+void reconnect_print_stats(void)
+{
+    printf("Reconnect: %d reconnects, %.3f s total without device, longest gap %.3f s\n",
+           reconnect_stats.count, reconnect_stats.gap_total_ns / 1e9, reconnect_stats.gap_max_ns / 1e9);
+}
+
+/**
+ * Batched version of the --read-input / --read-input-forever loop: each
+ * batch is printed with one write.  If "--reconnect" reopens the device,
+ * the loop carries on with the new handle (which is also the new 'dev')
+ */
+int read_input_batched(hid_device* d, int buflen, bool forever)
+{
+    uint8_t* reports = malloc((size_t)batch_max * buflen);
+    int* lens = malloc(batch_max * sizeof(int));
+    uint64_t* times = malloc(batch_max * sizeof(uint64_t));
+    size_t outsize = (size_t)batch_max * (FORMATBUF_SIZE(buflen) + 32);
+    char* out = malloc(outsize);
+    int res = 0;
+
+    msg("Reading up to %d-byte input reports in batches of %d, %d msec timeout...\n",
+        buflen, batch_max, timeout_millis);
+    do {
+        res = hid_read_timeout(d, reports, buflen, timeout_millis);
+        times[0] = now_nsec();
+        if( res < 0 ) {  // error or removed device
+            msg("error: %ls\n", hid_error(d));
+            op_errors++;
+            if( forever && reconnect_secs >= 0 && (d = device_reconnect(d)) ) {
+                continue;
+            }
+            break;
+        }
+        if( res == 0 ) {
+            msg("read 0 bytes:\n");
+            continue;
+        }
+        int n = 0;
+        lens[n++] = res;
+        hid_set_nonblocking(d, 1);
+        while( n < batch_max ) {
+            res = hid_read(d, reports + (size_t)n * buflen, buflen);
+            times[n] = now_nsec();
+            if( res <= 0 ) break;  // queue empty, or error (seen on next blocking read)
+            lens[n++] = res;
+        }
+        hid_set_nonblocking(d, 0);
+
+        batch_stats.wakeups++;
+        batch_stats.reports += n;
+        if( (uint64_t)n > batch_stats.max ) batch_stats.max = n;
+        int bucket = 0;
+        while( bucket < 15 && (2 << bucket) <= n ) bucket++;
+        batch_stats.sizes[bucket]++;
+
+        char* p = out;
+        for( int i=0; i<n; i++ ) {
+            uint8_t* report = reports + (size_t)i * buflen;
+            input_report_arrived(report, lens[i], times[i]);
+            memset(report + lens[i], 0, buflen - lens[i]);
+            p += format_read_header(p, lens[i]);
+            if( reports_printed() ) { p += formatbuf(p, report, buflen, print_base, print_width); }
+        }
+        fwrite(out, 1, p - out, stdout);
+    } while( forever && !stop_requested );
+
+    free(out);
+    free(times);
+    free(lens);
+    free(reports);
+    return 0;
+}
+
+/**
+ * "--send-output-file" / "--send-feature-file": stream reports from a
+ * file (or stdin) to the device back-to-back, as hex lines or raw records
+ */
+bool file_binary = false;   // "--file-format bin", else hex lines
+
+#define SEND_FILE_MAX_FAILED 64     // failed write indices to remember
+#define SEND_FILE_PROGRESS_NSEC 200000000ull
+
+// hex digit value, or -1 if not a hex digit
+static int8_t hexval[256];
+
+void hexval_init(void)
+{
+    memset(hexval, -1, sizeof(hexval));
+    for( int i=0; i<10; i++ ) hexval['0'+i] = i;
+    for( int i=0; i<6; i++ ) { hexval['a'+i] = 10+i; hexval['A'+i] = 10+i; }
+}
+
+/**
+ * Decode one line of hex into 'out' (max 'outlen' bytes).
+ * Bytes are pairs of hex digits, optionally "0x"-prefixed and separated
+ * by spaces, commas, or colons; a single digit alone is one byte.
+ * '#' starts a comment. Returns number of bytes, or -1 on bad input
+ */
+int hexline2buf(uint8_t* out, int outlen, const char* line)
+{
+    const uint8_t* s = (const uint8_t*)line;
+    int n = 0;
+    for(;;) {
+        while( *s == ' ' || *s == '\t' || *s == ',' || *s == ':' ) s++;
+        if( *s == '\0' || *s == '\n' || *s == '\r' || *s == '#' ) break;
+        if( s[0] == '0' && (s[1] == 'x' || s[1] == 'X') ) s += 2;
+        if( hexval[s[0]] < 0 ) return -1;
+        if( hexval[s[1]] < 0 ) {  // lone digit, e.g. "1,2,3"
+            if( n >= outlen ) return -1;
+            out[n++] = hexval[*s++];
+            continue;
+        }
+        while( hexval[s[0]] >= 0 && hexval[s[1]] >= 0 ) {
+            if( n >= outlen ) return -1;
+            out[n++] = (hexval[s[0]] << 4) | hexval[s[1]];
+            s += 2;
+        }
+        if( hexval[s[0]] >= 0 ) return -1;  // odd digit count in a run
+    }
+    return n;
+}
+
+/**
+ * Open report file 'path' ("-" for stdin) for file_next_report(),
+ * and get its size if 'filesize' isn't NULL. Returns NULL on error
+ */
+FILE* file_open_reports(const char* path, int buflen, long long* filesize)
+{
+    FILE* fp = stdin;
+    if( filesize ) *filesize = 0;
+    if( file_binary && !buflen ) {
+        msg("Error: binary records need a length. Use --len to specify.\n");
+        return NULL;
+    }
+    if( strcmp(path, "-") != 0 ) {
+        fp = fopen(path, file_binary ? "rb" : "r");
+        if( !fp ) {
+            msg("Error: could not open '%s': %s\n", path, strerror(errno));
+            return NULL;
+        }
+        if( filesize && fseek(fp, 0, SEEK_END) == 0 ) {
+            *filesize = ftell(fp);
+            fseek(fp, 0, SEEK_SET);
+        }
+    }
+#ifdef _WIN32
+    else if( file_binary ) {
+        _setmode(_fileno(stdin), _O_BINARY);
+    }
+#endif
+    static char iobuf[64*1024];
+    setvbuf(fp, iobuf, _IOFBF, sizeof(iobuf));
+    hexval_init();
+    return fp;
+}
+
+/**
+ * Next report from 'fp' into 'report', zero-padded to 'buflen' if set.
+ * If 'usec' isn't NULL, a hex line may start with "@<usecs>", a time
+ * stored there (-1 if the line has none).
+ * Returns its length, 0 at end of file, or -1 for a bad line
+ */
+int file_next_report(FILE* fp, uint8_t* report, int buflen, long long* lineno, int64_t* usec)
+{
+    char line[MAX_BUF*6];
+    if( usec ) *usec = -1;
+    if( file_binary ) {
+        int len = fread(report, 1, buflen, fp);
+        if( len <= 0 ) return 0;
+        if( len < buflen ) memset(report + len, 0, buflen - len);
+        return buflen;
+    }
+    for(;;) {
+        if( !fgets(line, sizeof(line), fp) ) return 0;
+        (*lineno)++;
+        char* hex = line;
+        while( *hex == ' ' || *hex == '\t' ) hex++;
+        if( usec && *hex == '@' ) {
+            *usec = strtoll(hex+1, &hex, 10);
+            if( *usec < 0 || (*hex != ' ' && *hex != '\t') ) {
+                msg("Error: bad time on line %lld\n", *lineno);
+                return -1;
+            }
+        }
+        int n = hexline2buf(report, buflen ? buflen : MAX_BUF, hex);
+        if( n == 0 ) continue;  // blank or comment line
+        if( n < 0 ) {
+            msg("Error: bad or too long hex on line %lld\n", *lineno);
+            return -1;
+        }
+        int len = buflen ? buflen : n;
+        if( n < len ) memset(report + n, 0, len - n);
+        return len;
+    }
+}
+
+/**
+ * Send every report in file 'path' ("-" for stdin)
+ */
+void send_file(hid_device* dev, int cmd, char* path, int buflen)
+{
+    long long filesize;
+    FILE* fp = file_open_reports(path, buflen, &filesize);
+    if( !fp ) { op_errors++; return; }
+
+    const char* kind = (cmd == CMD_SEND_OUTPUT_FILE) ? "output" : "feature";
+    msg("Sending %s reports from %s (%s)...\n", kind,
+        (fp == stdin) ? "stdin" : path, file_binary ? "binary records" : "hex lines");
+
+    uint8_t report[MAX_BUF];
+    long long sent = 0, bytes = 0, nfailed = 0, lineno = 0;
+    long long failed[SEND_FILE_MAX_FAILED];
+    uint64_t start = now_nsec(), next_progress = start + SEND_FILE_PROGRESS_NSEC;
+
+    while( !stop_requested ) {
+        int len = file_next_report(fp, report, buflen, &lineno, NULL);
+        if( len == 0 ) break;
+        if( len < 0 ) {
+            if( nfailed < SEND_FILE_MAX_FAILED ) failed[nfailed] = sent;
+            nfailed++;
+            sent++;
+            continue;
+        }
+
+        int res = (cmd == CMD_SEND_OUTPUT_FILE) ? hid_write(dev, report, len)
+                                                : hid_send_feature_report(dev, report, len);
+        if( res < 0 ) {
+            if( nfailed < SEND_FILE_MAX_FAILED ) failed[nfailed] = sent;
+            nfailed++;
+        } else {
+            bytes += res;
+        }
+        sent++;
+
+        uint64_t now = now_nsec();
+        if( now >= next_progress && !msg_quiet ) {
+            next_progress = now + SEND_FILE_PROGRESS_NSEC;
+            double secs = (now - start) / 1e9;
+            msg("\rSent %lld reports, %lld bytes, %.0f bytes/sec", sent, bytes, bytes / secs);
+            if( filesize > 0 ) {
+                msg(" (%.0f%%)", 100.0 * ftell(fp) / filesize);
+            }
+            msg("   ");
+        }
+    }
+    if( fp != stdin ) fclose(fp);
+
+    double secs = (now_nsec() - start) / 1e9;
+    msg("\r");
+    printf("Sent %lld %s reports, %lld bytes in %.3f s: %.0f bytes/sec, %lld failed\n",
+           sent, kind, bytes, secs, secs > 0 ? bytes / secs : 0.0, nfailed);
+    if( nfailed ) {
+        printf("Failed report indices:");
+        for( long long i=0; i < nfailed && i < SEND_FILE_MAX_FAILED; i++ ) {
+            printf(" %lld", failed[i]);
+        }
+        printf( (nfailed > SEND_FILE_MAX_FAILED) ? " ...\n" : "\n");
+    }
+    op_errors += nfailed;
+}
+
+/**
+ * "--read-input-file": hand each report in file 'path' ("-" for stdin) to
+ * the usual Input report handling ("--seq", "--verify-crc", "--timestamps",
+ * "--summarize", "--expect"...) as if a device had sent it.  Hex lines
+ * can give their arrival time as "@<usecs>", else they arrive when read
+ */
+void read_input_file(char* path, int buflen)
+{
+    FILE* fp = file_open_reports(path, buflen, NULL);
+    if( !fp ) { op_errors++; return; }
+    msg("Reading input reports from %s (%s)...\n",
+        (fp == stdin) ? "stdin" : path, file_binary ? "binary records" : "hex lines");
+
+    uint8_t report[MAX_BUF];
+    long long lineno = 0, count = 0;
+    uint64_t start = now_nsec();
+    int64_t usec;
+    int len;
+    while( !stop_requested && (len = file_next_report(fp, report, buflen, &lineno, &usec)) != 0 ) {
+        if( len < 0 ) { op_errors++; continue; }
+        input_report_arrived(report, len, (usec >= 0) ? start + (uint64_t)usec * 1000 : now_nsec());
+        print_read_header(len);
+        if( reports_printed() ) { printbuf(report, len, print_base, print_width); }
+        count++;
+    }
+    if( fp != stdin ) fclose(fp);
+    msg("Read %lld input reports from file\n", count);
+}
+
+/**
+ * "--pipeline": Output report requests / Input report responses with up
+ * to 'pipe_window' requests in flight, matched up by a tag byte
+ */
+int pipe_window = 1;        // max requests in flight
+int pipe_tag_out = 1;       // offset of tag byte in Output report
+int pipe_tag_in = 1;        // offset of tag byte in Input report
+int pipe_retries = 0;       // resends of a request before giving up
+bool pipe_compare = false;  // "--pipeline-compare": rerun with window 1
+
+typedef struct {
+    bool in_flight;
+    int tries;
+    uint64_t sent_ns;
+} pipe_slot_t;
+
+typedef struct {
+    int window;
+    long done;
+    long failed;
+    long retries;
+    long unmatched;         // responses with a tag not in flight
+    double secs;
+    histogram_t latency;    // in usec
+} pipe_result_t;
+
+/**
+ * Run 'count' transactions of request 'req' (of 'buflen' bytes) with
+ * up to 'window' in flight
+ */
+pipe_result_t pipeline_run(hid_device* dev, uint8_t* req, int buflen, long count, int window)
+{
+    static pipe_slot_t slots[256];
+    static uint8_t resp[MAX_BUF];
+    static uint8_t out[MAX_BUF];
+    static pipe_result_t r;
+    memset(slots, 0, sizeof(slots));
+    memset(&r, 0, sizeof(r));
+    r.window = window;
+
+    memcpy(out, req, buflen);
+    uint64_t timeout_ns = (uint64_t)timeout_millis * 1000000;
+    long issued = 0;
+    int in_flight = 0;
+    uint8_t next_tag = 0;
+    uint64_t start = now_nsec();
+
+    while( (issued < count || in_flight) && !stop_requested ) {
+        // fill the window
+        while( issued < count && in_flight < window ) {
+            while( slots[next_tag].in_flight ) next_tag++;
+            uint8_t tag = next_tag++;
+            out[pipe_tag_out] = tag;
+            if( hid_write(dev, out, buflen) < 0 ) {
+                msg("error: %ls\n", hid_error(dev));
+                r.failed += count - issued;
+                issued = count;
+                break;
+            }
+            slots[tag].in_flight = true;
+            slots[tag].tries = 1;
+            slots[tag].sent_ns = now_nsec();
+            issued++;
+            in_flight++;
+        }
+        if( !in_flight ) break;
+
+        // wait for a response, but not past the oldest request's deadline
+        uint64_t now = now_nsec();
+        uint64_t oldest = now;
+        for( int t=0; t<256; t++ ) {
+            if( slots[t].in_flight && slots[t].sent_ns < oldest ) oldest = slots[t].sent_ns;
+        }
+        int wait_ms = (oldest + timeout_ns > now) ? (int)((oldest + timeout_ns - now) / 1000000) + 1 : 0;
+        int res = hid_read_timeout(dev, resp, buflen, wait_ms);
+        now = now_nsec();
+        if( res < 0 ) {
+            msg("error: %ls\n", hid_error(dev));
+            r.failed += in_flight + (count - issued);
+            break;
+        }
+        if( res > pipe_tag_in ) {
+            uint8_t tag = resp[pipe_tag_in];
+            if( slots[tag].in_flight ) {
+                slots[tag].in_flight = false;
+                in_flight--;
+                r.done++;
+                hist_add(&r.latency, (now - slots[tag].sent_ns) / 1000);
+            } else {
+                r.unmatched++;
+            }
+        }
+
+        // retry or give up on requests that timed out
+        for( int t=0; t<256; t++ ) {
+            if( !slots[t].in_flight || now - slots[t].sent_ns < timeout_ns ) continue;
+            if( slots[t].tries <= pipe_retries ) {
+                out[pipe_tag_out] = t;
+                r.retries++;
+                if( hid_write(dev, out, buflen) >= 0 ) {
+                    slots[t].tries++;
+                    slots[t].sent_ns = now_nsec();
+                    continue;
+                }
+                msg("error: %ls\n", hid_error(dev));  // resend failed: give up on it
+            }
+            slots[t].in_flight = false;
+            in_flight--;
+            r.failed++;
+        }
+    }
+    r.secs = (now_nsec() - start) / 1e9;
+    return r;
+}
+
+void pipeline_print(pipe_result_t* r)
+{
+    histogram_t* h = &r->latency;
+    printf("Pipeline W=%d: %ld transactions in %.3f s: %.1f trans/sec, %ld retries, %ld failed, %ld unmatched\n",
+           r->window, r->done, r->secs, r->secs > 0 ? r->done / r->secs : 0.0,
+           r->retries, r->failed, r->unmatched);
+    if( h->count ) {
+        printf("Pipeline W=%d: latency mean %.3f ms, p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+               r->window, h->mean / 1e3, hist_percentile(h, 50) / 1e3, hist_percentile(h, 90) / 1e3,
+               hist_percentile(h, 99) / 1e3, h->max / 1e3);
+    }
+}
+
+/**
+ * "--duplex": read Input reports on one thread while another writes
+ * Output (or Feature) reports from a file, stdin, or at a fixed rate.
+ * Both threads log into one ring; each event is timestamped while
+ * holding the ring's lock, so the log is in true order.  The main
+ * thread prints it, so printing never holds up the device.
+ */
+#define DUPLEX_LOG_SLOTS 4096
+
+typedef struct {
+    uint64_t t;
+    bool out;               // written by us, else read from device
+    int len;                // bytes, or -1 on error
+    bool shown;             // Input report to print, see reports_printed()
+    char header[96];        // its "read N bytes..." line, if any
+} duplex_event_t;
+
+typedef struct {
+    hid_device* dev;
+    bool feature;           // write Feature reports, else Output reports
+    FILE* fp;               // report file, or NULL if generating at 'hz'
+    int hz;
+    long count;             // reports to generate, 0 = until Ctrl-C
+    uint8_t* payload;       // generated report
+    int buflen;
+
+    mutex_t lock;           // guards the log ring
+    mutex_t write_lock;     // held by the writer while writing
+    bool abandoned;         // writer must not write again, main is done with the device
+    duplex_event_t* events;
+    uint8_t* data;          // 'buflen' bytes per event slot
+    uint64_t head;          // events logged
+    uint64_t tail;          // events printed
+    uint64_t dropped;       // events lost because the ring was full
+    int writer_done;
+    int reader_done;
+    int failed;             // a read error ended the run
+
+    uint64_t start_ns;
+    uint64_t written, write_errors, read;
+} duplex_t;
+
+/**
+ * Add an event to the log. Input reports have already been through
+ * input_report_arrived() on the reader thread; whether and how each one
+ * is printed is decided there, as it only holds for that report
+ */
+void duplex_log(duplex_t* d, bool out, uint8_t* report, int len)
+{
+    bool shown = out || reports_printed();
+    char header[96] = "";
+    if( !out && shown ) format_read_header(header, len);
+    mutex_lock(&d->lock);
+    if( d->head - d->tail >= DUPLEX_LOG_SLOTS ) {
+        d->dropped++;
+    } else {
+        int slot = d->head % DUPLEX_LOG_SLOTS;
+        duplex_event_t* e = &d->events[slot];
+        e->t = now_nsec();
+        e->out = out;
+        e->len = len;
+        e->shown = shown;
+        strcpy(e->header, header);
+        if( len > 0 ) memcpy(d->data + (size_t)slot * d->buflen, report, len);
+        d->head++;
+    }
+    mutex_unlock(&d->lock);
+}
+
+void* duplex_writer(void* arg)
+{
+    duplex_t* d = arg;
+    uint8_t report[MAX_BUF];
+    long long lineno = 0;
+    uint64_t period = d->hz ? 1000000000ull / d->hz : 0;
+    uint64_t next = now_nsec();
+
+    while( !stop_requested && !atomic_load_int(&d->failed) ) {
+        int len;
+        if( d->fp ) {
+            len = file_next_report(d->fp, report, d->buflen, &lineno, NULL);
+            if( len == 0 ) break;
+            if( len < 0 ) { d->write_errors++; continue; }
+        }
+        else {
+            if( d->count && d->written + d->write_errors >= (uint64_t)d->count ) break;
+            uint64_t now = now_nsec();
+            while( now < next ) {   // sleep most of the wait, spin the rest
+                if( next - now > 2000000 ) sleep_ms(1);
+                now = now_nsec();
+            }
+            next = (now > next + period) ? now + period : next + period;  // don't burst to catch up
+            memcpy(report, d->payload, d->buflen);
+            len = d->buflen;
+        }
+        mutex_lock(&d->write_lock);
+        if( d->abandoned || stop_requested ) {  // e.g. woke up from stdin after Ctrl-C
+            mutex_unlock(&d->write_lock);
+            break;
+        }
+        int res = d->feature ? hid_send_feature_report(d->dev, report, len)
+                             : hid_write(d->dev, report, len);
+        mutex_unlock(&d->write_lock);
+        duplex_log(d, true, report, (res < 0) ? -1 : len);
+        if( res < 0 ) d->write_errors++;
+        else d->written++;
+    }
+    atomic_store_int(&d->writer_done, 1);
+    return NULL;
+}
+
+void* duplex_reader(void* arg)
+{
+    duplex_t* d = arg;
+    uint8_t report[MAX_BUF];
+    while( !stop_requested ) {
+        bool writer_done = atomic_load_int(&d->writer_done);
+        int res = hid_read_timeout(d->dev, report, d->buflen, timeout_millis);
+        if( res > 0 ) {
+            input_report_arrived(report, res, now_nsec());
+            duplex_log(d, false, report, res);
+            d->read++;
+        }
+        else if( res < 0 ) {
+            duplex_log(d, false, report, -1);
+            atomic_store_int(&d->failed, 1);
+            break;
+        }
+        else if( writer_done ) {
+            break;  // nothing more came in after the last write
+        }
+    }
+    atomic_store_int(&d->reader_done, 1);
+    return NULL;
+}
+
+/**
+ * Print logged events up to now, returns number printed
+ */
+int duplex_print(duplex_t* d)
+{
+    static char out[FORMATBUF_SIZE(MAX_BUF) + 64];
+    mutex_lock(&d->lock);
+    uint64_t head = d->head;
+    mutex_unlock(&d->lock);
+    int n = 0;
+    for( uint64_t i = d->tail; i < head; i++, n++ ) {  // slots up to 'head' won't be reused yet
+        int slot = i % DUPLEX_LOG_SLOTS;
+        duplex_event_t* e = &d->events[slot];
+        double secs = (e->t - d->start_ns) / 1e9;
+        const char* dir = e->out ? (d->feature ? "FEAT" : "OUT ") : "IN  ";
+        if( e->len < 0 ) {
+            printf("%10.6f %s error\n", secs, dir);
+            continue;
+        }
+        if( !e->shown ) continue;
+        char* p = out + sprintf(out, "%10.6f %s ", secs, dir);
+        if( e->header[0] ) {
+            p += sprintf(p, "%s", e->header);  // with any timestamp, LATE, or CRC BAD marks
+        } else {
+            p += sprintf(p, "%d bytes:\n", e->len);
+        }
+        p += formatbuf(p, d->data + (size_t)slot * d->buflen, e->len, print_base, print_width);
+        fwrite(out, 1, p - out, stdout);
+    }
+    mutex_lock(&d->lock);
+    d->tail = head;
+    mutex_unlock(&d->lock);
+    return n;
+}
+
+/**
+ * Run "--duplex <source>" on 'dev' until the source is used up and the
+ * device goes quiet, a read fails, or Ctrl-C
+ */
+void duplex_free(duplex_t* d)
+{
+    if( d->fp && d->fp != stdin ) fclose(d->fp);
+    mutex_destroy(&d->lock);
+    mutex_destroy(&d->write_lock);
+    free(d->events);
+    free(d->data);
+    free(d);
+}
+
+void duplex_run(hid_device* dev, command_t* c, int buflen)
+{
+    duplex_t* d = calloc(1, sizeof(duplex_t));  // not freed if the writer is left blocked on its source
+    const char* src = c->arg;
+    d->dev = dev;
+    d->buflen = buflen;
+    d->feature = (strncmp(src, "feature:", 8) == 0);
+    if( d->feature ) src += 8;
+    if( strncmp(src, "rate:", 5) == 0 ) {
+        d->hz = c->num;
+        d->count = c->num2;
+        d->payload = c->data;
+    }
+    else {
+        d->fp = file_open_reports(src, buflen, NULL);
+        if( !d->fp ) { free(d); op_errors++; return; }
+    }
+    mutex_init(&d->lock);
+    mutex_init(&d->write_lock);
+    d->events = calloc(DUPLEX_LOG_SLOTS, sizeof(duplex_event_t));
+    d->data = malloc((size_t)DUPLEX_LOG_SLOTS * buflen);
+
+    msg("Duplex: reading %d-byte input reports while writing %s reports from %s...\n", buflen,
+        d->feature ? "feature" : "output", d->fp ? ((d->fp == stdin) ? "stdin" : src) : "generator");
+    d->start_ns = now_nsec();
+    thread_t reader, writer;
+    if( !thread_start(&reader, duplex_reader, d) ) {
+        msg("Error: could not start reader thread.\n");
+        op_errors++;
+        duplex_free(d);
+        return;
+    }
+    bool writer_started = thread_start(&writer, duplex_writer, d);
+    if( !writer_started ) {
+        msg("Error: could not start writer thread.\n");
+        op_errors++;
+        atomic_store_int(&d->writer_done, 1);
+    }
+    while( !atomic_load_int(&d->reader_done) ) {
+        if( !duplex_print(d) ) sleep_ms(1);
+    }
+    thread_join(reader);
+    bool detached = false;
+    if( writer_started && (atomic_load_int(&d->writer_done) || !stop_requested) ) {
+        thread_join(writer);
+    } else if( writer_started ) {
+        mutex_lock(&d->write_lock);  // blocked reading its source: make sure it never writes again
+        d->abandoned = true;
+        mutex_unlock(&d->write_lock);
+        thread_detach(writer);
+        detached = true;
+    }
+    duplex_print(d);
+
+    double secs = (now_nsec() - d->start_ns) / 1e9;
+    printf("Duplex: wrote %llu reports (%llu failed), read %llu reports in %.3f s: %.1f writes/sec, %.1f reads/sec\n",
+           (unsigned long long)d->written, (unsigned long long)d->write_errors,
+           (unsigned long long)d->read, secs,
+           secs > 0 ? d->written / secs : 0.0, secs > 0 ? d->read / secs : 0.0);
+    if( d->dropped ) {
+        printf("Duplex: %llu events not logged, printing fell behind\n", (unsigned long long)d->dropped);
+    }
+    op_errors += d->write_errors + d->failed;
+    if( !detached ) {
+        duplex_free(d);
+    }  // else the writer may still be inside file_next_report(d->fp): leave it all
+}
+
+/**
+ * "--read-all-interfaces": open every interface of one physical device
+ * (all enumerated paths with the same vid/pid/serial as the first match
+ * of the filters) and read them all at once, one thread each.  Reports
+ * are queued with the time their read returned and printed merged in
+ * time order, tagged with the interface number.  A report is held until
+ * it is 'window' old, so one from a thread that was a little slower to
+ * queue it still comes out in order; the price is that much delay.
+ */
+#define MERGE_MAX_IFACES 16
+#define MERGE_QUEUE_SLOTS 1024
+#define MERGE_WINDOW_MS 10
+
+typedef struct {
+    hid_device* dev;
+    int iface;              // interface number, for tagging reports
+    char path[MAX_STR];     // each has its own, e.g. each top-level collection on Windows
+    uint16_t usage_page;
+    char tag[32];           // "iface N", plus usagePage if N has several paths
+    int buflen;
+    mutex_t lock;           // guards the queue
+    uint64_t* times;
+    int* lens;
+    uint8_t* data;          // 'buflen' bytes per slot
+    uint64_t head;          // reports queued by the reader
+    uint64_t tail;          // reports taken by the merge
+    uint64_t dropped;       // queue was full
+    uint64_t reports;
+    int done;               // reader stopped after a read error
+} merge_src_t;
+
+void* merge_reader(void* arg)
+{
+    merge_src_t* s = arg;
+    uint8_t report[MAX_BUF];
+    while( !stop_requested ) {
+        int res = hid_read_timeout(s->dev, report, s->buflen, timeout_millis);
+        uint64_t t = now_nsec();
+        if( res < 0 ) break;
+        if( res == 0 ) continue;
+        mutex_lock(&s->lock);
+        if( s->head - s->tail >= MERGE_QUEUE_SLOTS ) {
+            s->dropped++;
+        } else {
+            int slot = s->head % MERGE_QUEUE_SLOTS;
+            s->times[slot] = t;
+            s->lens[slot] = res;
+            memcpy(s->data + (size_t)slot * s->buflen, report, res);
+            s->head++;
+        }
+        mutex_unlock(&s->lock);
+    }
+    atomic_store_int(&s->done, 1);
+    return NULL;
+}
+
+/**
+ * Print the oldest queued report of any interface if it is older than
+ * 'before' (in now_nsec() time). Returns false if there was none
+ */
+bool merge_emit(merge_src_t* srcs, int n, uint64_t before, uint64_t* last_t, uint64_t* late)
+{
+    static char out[FORMATBUF_SIZE(MAX_BUF) + 128];
+    merge_src_t* oldest = NULL;
+    uint64_t oldest_t = 0;
+    for( int i=0; i<n; i++ ) {     // k-way merge: pick the oldest head
+        merge_src_t* s = &srcs[i];
+        mutex_lock(&s->lock);
+        if( s->head != s->tail ) {
+            uint64_t t = s->times[s->tail % MERGE_QUEUE_SLOTS];
+            if( !oldest || t < oldest_t ) { oldest = s; oldest_t = t; }
+        }
+        mutex_unlock(&s->lock);
+    }
+    if( !oldest || oldest_t >= before ) return false;
+
+    int slot = oldest->tail % MERGE_QUEUE_SLOTS;  // reader won't reuse the slot until tail moves
+    uint8_t* report = oldest->data + (size_t)slot * oldest->buflen;
+    int len = oldest->lens[slot];
+    if( oldest_t < *last_t ) (*late)++;   // queued after a newer report was already printed
+    *last_t = oldest_t;
+    oldest->reports++;
+
+    input_report_arrived(report, len, oldest_t);
+    char* p = out;
+    int hlen = format_read_header(out + 64, len);
+    if( hlen ) {
+        p += sprintf(p, "%s ", oldest->tag);
+        memmove(p, out + 64, hlen);
+        p += hlen;
+    } else if( reports_printed() ) {
+        p += sprintf(p, "%s:\n", oldest->tag);
+    }
+    if( reports_printed() ) { p += formatbuf(p, report, len, print_base, print_width); }
+    fwrite(out, 1, p - out, stdout);
+
+    mutex_lock(&oldest->lock);
+    oldest->tail++;
+    mutex_unlock(&oldest->lock);
+    return true;
+}
+
+/**
+ * Run "--read-all-interfaces" until Ctrl-C or every interface fails
+ */
+void merge_run(int buflen, int window_ms)
+{
+    struct hid_device_info *devs = hid_enumerate(vid, pid), *d, *first = NULL;
+    for( d = devs; d && !first; d = d->next ) {
+        if( device_matches(d) ) first = d;
+    }
+    if( !first ) {
+        msg("Error: no matching device.\n");
+        op_errors++;
+        hid_free_enumeration(devs);
+        return;
+    }
+    merge_src_t srcs[MERGE_MAX_IFACES];
+    int n = 0;
+    for( d = devs; d && n < MERGE_MAX_IFACES; d = d->next ) {
+        if( d->vendor_id != first->vendor_id || d->product_id != first->product_id ) continue;
+        if( (d->serial_number == NULL) != (first->serial_number == NULL) ) continue;
+        if( d->serial_number && wcscmp(d->serial_number, first->serial_number) != 0 ) continue;
+        int i;
+        for( i=0; i<n && strcmp(d->path, srcs[i].path); i++ ) { }
+        if( i < n ) continue;  // another usage of a path we have
+        hid_device* h = hid_open_path(d->path);
+        if( !h ) {
+            msg("Error: could not open interface %d (%s)\n", d->interface_number, d->path);
+            op_errors++;
+            continue;
+        }
+        merge_src_t* s = &srcs[n++];
+        memset(s, 0, sizeof(*s));
+        s->dev = h;
+        s->iface = d->interface_number;
+        strncpy(s->path, d->path, MAX_STR-1);
+        s->usage_page = d->usage_page;
+        s->buflen = buflen;
+        mutex_init(&s->lock);
+        s->times = malloc(MERGE_QUEUE_SLOTS * sizeof(uint64_t));
+        s->lens = malloc(MERGE_QUEUE_SLOTS * sizeof(int));
+        s->data = malloc((size_t)MERGE_QUEUE_SLOTS * buflen);
+        msg("Opened interface %d: %s\n", s->iface, d->path);
+    }
+    hid_free_enumeration(devs);
+    for( int i=0; i<n; i++ ) {
+        bool shared = false;
+        for( int j=0; j<n; j++ ) shared |= (j != i && srcs[j].iface == srcs[i].iface);
+        if( shared ) sprintf(srcs[i].tag, "iface %d/%04X", srcs[i].iface, srcs[i].usage_page);
+        else sprintf(srcs[i].tag, "iface %d", srcs[i].iface);
+    }
+
+    thread_t threads[MERGE_MAX_IFACES];
+    int started = 0;
+    for( ; started < n; started++ ) {
+        if( !thread_start(&threads[started], merge_reader, &srcs[started]) ) {
+            msg("Error: could not start reader thread.\n");
+            break;
+        }
+    }
+    msg("Reading %d interfaces, up to %d-byte reports, merged with %d msec reorder window...\n",
+        started, buflen, window_ms);
+
+    uint64_t window_ns = (uint64_t)window_ms * 1000000, last_t = 0, late = 0;
+    int running = started;
+    while( running ) {
+        if( !merge_emit(srcs, started, now_nsec() - window_ns, &last_t, &late) ) {
+            sleep_ms(1);
+        }
+        running = 0;
+        for( int i=0; i<started; i++ ) running += !atomic_load_int(&srcs[i].done);
+    }
+    for( int i=0; i<started; i++ ) thread_join(threads[i]);
+    while( merge_emit(srcs, started, UINT64_MAX, &last_t, &late) ) { }  // whatever is left
+
+    for( int i=0; i<n; i++ ) {
+        merge_src_t* s = &srcs[i];
+        printf("Merge: %s: %llu reports, %llu dropped\n", s->tag,
+               (unsigned long long)s->reports, (unsigned long long)s->dropped);
+        if( !stop_requested && i < started ) {
+            msg("Error: read failed on %s\n", s->tag);
+            op_errors++;
+        }
+        hid_close(s->dev);
+        free(s->times);
+        free(s->lens);
+        free(s->data);
+    }
+    if( late ) {
+        printf("Merge: %llu reports out of order, try a longer reorder window\n", (unsigned long long)late);
+    }
+}
+
+/**
+ * Sizes of each report in a report descriptor, by reportId
+ */
+#define REPORT_INPUT   0
+#define REPORT_OUTPUT  1
+#define REPORT_FEATURE 2
+#define MAX_REPORTS    64
+
+typedef struct {
+    uint8_t id;             // reportId, 0 if descriptor doesn't use them
+    uint32_t bits[3];       // size of Input, Output, Feature report in bits
+} report_info_t;
+
+/**
+ * One Input/Output/Feature main item of a report descriptor, with the
+ * global state that applies to it
+ */
+typedef struct {
+    int kind;               // REPORT_INPUT, REPORT_OUTPUT, REPORT_FEATURE
+    uint8_t id;             // reportId, 0 if descriptor doesn't use them
+    uint32_t size;          // Report Size: bits per field
+    uint32_t count;         // Report Count: number of fields
+    uint32_t flags;         // main item data, bit 0 set = Constant (padding)
+    bool is_signed;         // Logical Minimum is negative
+} desc_item_t;
+
+/**
+ * Walk the items of a report descriptor, calling 'fn' for each
+ * Input/Output/Feature item.  Handles Push/Pop but not long items
+ * (which no known device uses).
+ * Returns 0, or -1 if descriptor is malformed
+ */
+int descriptor_walk(const uint8_t* desc, int len, void (*fn)(desc_item_t*, void*), void* ctx)
+{
+    struct { uint32_t size, count; uint8_t id; bool is_signed; } g = {0}, stack[8];
+    int sp = 0;
+    int i = 0;
+    while( i < len ) {
+        uint8_t prefix = desc[i++];
+        if( prefix == 0xFE ) {  // long item: bDataSize, bLongItemTag, data; skip it
+            if( i + 1 >= len || i + 2 + desc[i] > len ) return -1;
+            i += 2 + desc[i];
+            continue;
+        }
+        int size = (prefix & 3) == 3 ? 4 : (prefix & 3);
+        if( i + size > len ) return -1;
+        uint32_t val = 0;
+        for( int b=0; b<size; b++ ) val |= (uint32_t)desc[i+b] << (8*b);
+        i += size;
+
+        uint8_t type = (prefix >> 2) & 3;
+        uint8_t tag = prefix >> 4;
+        if( type == 1 ) {         // global
+            if( tag == 1 ) g.is_signed = size && (val >> (8*size - 1)) & 1;
+            else if( tag == 7 ) g.size = val;
+            else if( tag == 8 ) g.id = val;
+            else if( tag == 9 ) g.count = val;
+            else if( tag == 10 && sp < 8 ) stack[sp++] = g;
+            else if( tag == 11 && sp > 0 ) g = stack[--sp];
+        }
+        else if( type == 0 && (tag == 8 || tag == 9 || tag == 11) ) {  // main: Input/Output/Feature
+            desc_item_t item;
+            item.kind = (tag == 8) ? REPORT_INPUT : (tag == 9) ? REPORT_OUTPUT : REPORT_FEATURE;
+            item.id = g.id;
+            item.size = g.size;
+            item.count = g.count;
+            item.flags = val;
+            item.is_signed = g.is_signed;
+            fn(&item, ctx);
+        }
+    }
+    return 0;
+}
+
+typedef struct {
+    report_info_t* reports;
+    int n;
+    int max;
+} reports_ctx_t;
+
+/**
+ * Find the report with 'id', adding it if it's new. NULL if no room
+ */
+static report_info_t* reports_find(reports_ctx_t* rc, uint8_t id)
+{
+    for( int r=0; r<rc->n; r++ ) {
+        if( rc->reports[r].id == id ) return &rc->reports[r];
+    }
+    if( rc->n == rc->max ) return NULL;
+    report_info_t* report = &rc->reports[rc->n++];
+    memset(report, 0, sizeof(report_info_t));
+    report->id = id;
+    return report;
+}
+
+static void reports_add_item(desc_item_t* item, void* ctx)
+{
+    report_info_t* report = reports_find(ctx, item->id);
+    if( report ) { report->bits[item->kind] += item->size * item->count; }
+}
+
+/**
+ * Add up the size of each Input/Output/Feature report per reportId.
+ * Returns number of reports in 'reports', or -1 if descriptor is malformed
+ */
+int descriptor_reports(const uint8_t* desc, int len, report_info_t* reports, int max)
+{
+    reports_ctx_t rc = { reports, 0, max };
+    if( descriptor_walk(desc, len, reports_add_item, &rc) < 0 ) return -1;
+    return rc.n;
+}
+
+typedef struct {
+    report_info_t reports[MAX_REPORTS];
+    reports_ctx_t rc;       // bits so far in each Input report
+    field_t* fields;
+    int n;
+    int max;
+} fields_ctx_t;
+
+static void fields_add_item(desc_item_t* item, void* ctx)
+{
+    fields_ctx_t* fc = ctx;
+    if( item->kind != REPORT_INPUT ) return;
+    report_info_t* report = reports_find(&fc->rc, item->id);
+    if( !report ) return;
+    bool constant = item->flags & 1;
+    for( uint32_t i=0; i<item->count && !constant && item->size >= 1 && item->size <= 32; i++ ) {
+        if( fc->n == fc->max ) break;
+        field_t* f = &fc->fields[fc->n++];
+        f->id = item->id;
+        f->bit = report->bits[REPORT_INPUT] + i * item->size;
+        f->size = item->size;
+        f->is_signed = item->is_signed;
+    }
+    report->bits[REPORT_INPUT] += item->size * item->count;
+}
+
+/**
+ * List the data fields (not padding) of every Input report.
+ * Returns number of fields in 'fields', or -1 if descriptor is malformed
+ */
+int descriptor_input_fields(const uint8_t* desc, int len, field_t* fields, int max)
+{
+    static fields_ctx_t fc;
+    memset(&fc, 0, sizeof(fc));
+    fc.rc.reports = fc.reports;
+    fc.rc.max = MAX_REPORTS;
+    fc.fields = fields;
+    fc.max = max;
+    if( descriptor_walk(desc, len, fields_add_item, &fc) < 0 ) return -1;
+    return fc.n;
+}
+
+/**
+ * "--descriptor-file": print the reports and Input fields of a report
+ * descriptor saved as hex (e.g. "--get-report-descriptor" output).
+ * Returns false if the file can't be read or the descriptor is malformed
+ */
+bool descriptor_file_print(const char* path)
+{
+    static uint8_t desc[HID_API_MAX_REPORT_DESCRIPTOR_SIZE];
+    static field_t fields[MAX_FIELDS];
+    FILE* fp = fopen(path, "r");
+    if( !fp ) {
+        msg("Error: could not open '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+    hexval_init();
+    char line[MAX_BUF*6];
+    int len = 0, n = 0;
+    long long lineno = 0;
+    while( n >= 0 && fgets(line, sizeof(line), fp) ) {
+        lineno++;
+        n = hexline2buf(desc + len, sizeof(desc) - len, line);
+        if( n > 0 ) len += n;
+    }
+    fclose(fp);
+    if( n < 0 ) {
+        msg("Error: bad or too long hex on line %lld\n", lineno);
+        return false;
+    }
+
+    report_info_t reports[MAX_REPORTS];
+    int nreports = descriptor_reports(desc, len, reports, MAX_REPORTS);
+    int nfields = descriptor_input_fields(desc, len, fields, MAX_FIELDS);
+    if( nreports < 0 || nfields < 0 ) {
+        msg("Error: report descriptor is malformed\n");
+        return false;
+    }
+    printf("Report descriptor: %d bytes, %d reports\n", len, nreports);
+    for( int r=0; r<nreports; r++ ) {
+        report_info_t* ri = &reports[r];
+        printf("  report %d: input %u bits, output %u bits, feature %u bits\n", ri->id,
+               ri->bits[REPORT_INPUT], ri->bits[REPORT_OUTPUT], ri->bits[REPORT_FEATURE]);
+    }
+    for( int i=0; i<nfields; i++ ) {
+        field_t* f = &fields[i];
+        printf("  input field: report %d, bit %d, %d bits, %s\n", f->id, f->bit, f->size,
+               f->is_signed ? "signed" : "unsigned");
+    }
+    return true;
+}
+
+/**
+ * Report descriptor cache ("--cache"): descriptors are saved on disk keyed
+ * by vid/pid/release/serial/interface, so later runs skip the control
+ * transfer.  Off unless asked for, since a firmware change that keeps the
+ * release number would otherwise go unnoticed.
+ * Each file holds a "HIDDESC1 <len> <fnv1a>" line then the raw descriptor,
+ * and is ignored if the length or hash doesn't check out (it's an
+ * integrity check only, the device isn't asked).
+ */
+enum { DESC_CACHE_ON, DESC_CACHE_OFF, DESC_CACHE_REFRESH };
+int desc_cache_mode = DESC_CACHE_OFF;  // "--cache", "--no-cache", "--refresh-cache"
+
+uint32_t fnv1a(const uint8_t* p, int len)
+{
+    uint32_t h = 2166136261u;
+    for( int i=0; i<len; i++ ) { h = (h ^ p[i]) * 16777619u; }
+    return h;
+}
+
+/**
+ * Fill 'path' with the cache file for the open device, creating the
+ * cache directory if needed. Returns false if there's nowhere to cache.
+ */
+bool desc_cache_path(hid_device* dev, char* path, size_t size)
+{
+    struct hid_device_info* info = hid_get_device_info(dev);
+    if( !info ) { return false; }
+    char base[MAX_STR], dir[MAX_STR + 16];
+#ifdef _WIN32
+    const char* env = getenv("LOCALAPPDATA");
+    if( !env || !*env ) { return false; }
+    snprintf(base, sizeof(base), "%s", env);
+#else
+    const char* env = getenv("XDG_CACHE_HOME");
+    if( env && *env ) {
+        snprintf(base, sizeof(base), "%s", env);
+    } else {
+        env = getenv("HOME");
+        if( !env || !*env ) { return false; }
+        snprintf(base, sizeof(base), "%s/.cache", env);
+    }
+#endif
+    snprintf(dir, sizeof(dir), "%s/hidapitester", base);
+    make_dir(base);
+    if( make_dir(dir) != 0 && errno != EEXIST ) { return false; }
+    // serial number, if any, reduced to characters safe in a file name
+    char serial[64] = "";
+    if( info->serial_number ) {
+        int n = 0;
+        for( const wchar_t* w = info->serial_number; *w && n < (int)sizeof(serial)-1; w++ ) {
+            bool safe = (*w >= '0' && *w <= '9') || (*w >= 'A' && *w <= 'Z') || (*w >= 'a' && *w <= 'z');
+            serial[n++] = safe ? (char)*w : '-';
+        }
+        serial[n] = '\0';
+    }
+    snprintf(path, size, "%s/%04hx_%04hx_%04hx_%s_%d.desc", dir, info->vendor_id,
+             info->product_id, info->release_number, serial, info->interface_number);
+    return true;
+}
+
+int desc_cache_load(const char* path, uint8_t* desc, int size)
+{
+    FILE* fp = fopen(path, "rb");
+    if( !fp ) { return -1; }
+    int len = -1;
+    unsigned int hash;
+    char line[64];
+    if( fgets(line, sizeof(line), fp) &&
+        sscanf(line, "HIDDESC1 %d %x", &len, &hash) == 2 &&
+        len > 0 && len <= size &&
+        (int)fread(desc, 1, len, fp) == len && fgetc(fp) == EOF &&
+        fnv1a(desc, len) == hash ) {
+        fclose(fp);
+        return len;
+    }
+    fclose(fp);
+    return -1;
+}
+
+void desc_cache_store(const char* path, const uint8_t* desc, int len)
+{
+    char tmp[MAX_STR + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE* fp = fopen(tmp, "wb");
+    if( !fp ) { return; }
+    fprintf(fp, "HIDDESC1 %d %08x\n", len, fnv1a(desc, len));
+    bool ok = (int)fwrite(desc, 1, len, fp) == len;
+    ok = (fclose(fp) == 0) && ok;
+#ifdef _WIN32
+    remove(path);  // rename() won't replace on Windows
+#endif
+    if( !ok || rename(tmp, path) != 0 ) { remove(tmp); }
+}
+
+/**
+ * Get the report descriptor of 'dev' into 'desc', from the cache if
+ * it's there, otherwise from the device (and then cache it).
+ * Returns descriptor length, or -1 on error
+ */
+int descriptor_fetch(hid_device* dev, uint8_t* desc, int size)
+{
+    char path[MAX_STR];
+    bool cacheable = (desc_cache_mode != DESC_CACHE_OFF) && desc_cache_path(dev, path, sizeof(path));
+    if( desc_cache_mode != DESC_CACHE_OFF && !cacheable ) {
+        msginfo("Descriptor cache unavailable\n");
+    }
+    if( cacheable && desc_cache_mode == DESC_CACHE_ON ) {
+        int len = desc_cache_load(path, desc, size);
+        if( len > 0 ) {
+            msginfo("Descriptor cache hit: %s\n", path);
+            return len;
+        }
+        msginfo("Descriptor cache miss: %s\n", path);
+    }
+    int len = hid_get_report_descriptor(dev, desc, size);
+    if( len > 0 && cacheable ) {
+        desc_cache_store(path, desc, len);
+        msginfo("Descriptor cached: %s\n", path);
+    }
+    return len;
+}
+
+/**
+ * "--list-descriptors": like "--list-json", plus each device's report
+ * sizes from its report descriptor.  Devices are opened by a bounded pool
+ * of worker threads, and a device that takes longer than the per-device
+ * timeout is reported as timed out rather than stalling the scan (its
+ * worker is abandoned and replaced).
+ */
+#define LIST_WORKERS 8
+#define LIST_TIMEOUT_MS 2000
+
+enum { JOB_PENDING, JOB_RUNNING, JOB_DONE, JOB_TIMEOUT };
+
+typedef struct {
+    char path[MAX_STR];
+    int state;              // JOB_*, changed atomically
+    int abandoned;          // set atomically on timeout; stops the worker's tracing
+    uint64_t start_ns;      // when a worker picked it up
+    int desc_len;           // -1 if descriptor couldn't be read
+    bool opened;
+    report_info_t reports[MAX_REPORTS];
+    int nreports;
+    uint8_t desc[HID_API_MAX_REPORT_DESCRIPTOR_SIZE];
+} desc_job_t;
+
+typedef struct {
+    desc_job_t* jobs;
+    int njobs;
+    int next;               // next job for a worker to take
+    int refs;               // workers using it, plus the caller; the last one frees it
+} desc_scan_t;
+
+void desc_scan_release(desc_scan_t* scan)
+{
+    if( atomic_fetch_add_int(&scan->refs, -1) == 1 ) {
+        free(scan->jobs);
+        free(scan);
+    }
+}
+
+// workers still running; hidapi isn't torn down while one may be stuck in it
+int desc_workers_alive = 0;
+
+void* desc_worker(void* arg)
+{
+    desc_scan_t* scan = arg;
+    int i;
+    while( (i = atomic_fetch_add_int(&scan->next, 1)) < scan->njobs ) {
+        desc_job_t* job = &scan->jobs[i];
+        trace_cancel = &job->abandoned;
+        job->start_ns = now_nsec();
+        atomic_store_int(&job->state, JOB_RUNNING);
+        job->desc_len = -1;
+        hid_device* d = hid_open_path(job->path);
+        if( d ) {
+            job->opened = true;
+            job->desc_len = descriptor_fetch(d, job->desc, sizeof(job->desc));
+            job->nreports = descriptor_reports(job->desc, job->desc_len, job->reports, MAX_REPORTS);
+            hid_close(d);
+        }
+        if( !atomic_cas_int(&job->state, JOB_RUNNING, JOB_DONE) ) {
+            break;  // we were given up on, and a new worker took our place
+        }
+    }
+    trace_cancel = NULL;
+    desc_scan_release(scan);
+    atomic_fetch_add_int(&desc_workers_alive, -1);
+    return NULL;
+}
+
+// start one more worker on 'scan'
+void desc_worker_spawn(desc_scan_t* scan)
+{
+    thread_t t;
+    atomic_fetch_add_int(&desc_workers_alive, 1);
+    atomic_fetch_add_int(&scan->refs, 1);
+    if( thread_start(&t, desc_worker, scan) ) {
+        thread_detach(t);
+    } else {
+        atomic_fetch_add_int(&scan->refs, -1);  // the caller's reference keeps it above 0
+        atomic_fetch_add_int(&desc_workers_alive, -1);
+    }
+}
+
+/**
+ * Read the descriptors of 'paths' with the worker pool, waiting at
+ * most 'timeout_ms' for each.  Returns the scan, with one job per path;
+ * give it back with desc_scan_release() when done with the jobs.
+ * A timed-out worker is left where it is: its device handle (if the open
+ * ever returns) is leaked, it records no more trace events, and it keeps
+ * its own reference to the scan, so each call gets a scan of its own
+ */
+desc_scan_t* desc_scan(char** paths, int npaths, int timeout_ms)
+{
+    desc_scan_t* scan = calloc(1, sizeof(desc_scan_t));
+    scan->jobs = calloc(npaths, sizeof(desc_job_t));
+    scan->njobs = npaths;
+    scan->refs = 1;
+    for( int i=0; i<npaths; i++ ) {
+        strncpy(scan->jobs[i].path, paths[i], MAX_STR-1);
+    }
+    int workers = (npaths < LIST_WORKERS) ? npaths : LIST_WORKERS;
+    for( int w=0; w<workers; w++ ) {
+        desc_worker_spawn(scan);
+    }
+    msginfo("Reading %d report descriptors with %d workers, %d msec timeout each\n",
+            npaths, workers, timeout_ms);
+
+    int finished = 0;
+    while( finished < npaths ) {
+        sleep_ms(5);
+        finished = 0;
+        uint64_t now = now_nsec();
+        for( int i=0; i<npaths; i++ ) {
+            desc_job_t* job = &scan->jobs[i];
+            int state = atomic_load_int(&job->state);
+            if( state == JOB_RUNNING && now - job->start_ns > (uint64_t)timeout_ms * 1000000 &&
+                atomic_cas_int(&job->state, JOB_RUNNING, JOB_TIMEOUT) ) {
+                atomic_store_int(&job->abandoned, 1);
+                msginfo("Timed out reading descriptor: %s\n", job->path);
+                state = JOB_TIMEOUT;
+                desc_worker_spawn(scan);  // replace the stuck worker so the pool stays the same size
+            }
+            if( state == JOB_DONE || state == JOB_TIMEOUT ) finished++;
+        }
+    }
+    return scan;
+}
+
+void json_print_descriptor(desc_job_t* job)
+{
+    int state = atomic_load_int(&job->state);
+    const char* status = (state == JOB_TIMEOUT) ? "timeout" : !job->opened ? "open failed" :
+                         (job->desc_len <= 0) ? "read failed" : (job->nreports < 0) ? "malformed" : "ok";
+    printf("      \"report_descriptor\": {\n");
+    printf("        \"status\": \"%s\"", status);
+    if( state == JOB_DONE && job->desc_len > 0 ) {
+        printf(",\n        \"length\": %d", job->desc_len);
+    }
+    if( state == JOB_DONE && job->nreports > 0 ) {
+        printf(",\n        \"reports\": [\n");
+        for( int r=0; r<job->nreports; r++ ) {
+            report_info_t* ri = &job->reports[r];
+            printf("          { \"report_id\": %d, \"input_bytes\": %u, \"output_bytes\": %u, "
+                   "\"feature_bytes\": %u }%s\n", ri->id,
+                   (ri->bits[REPORT_INPUT] + 7) / 8, (ri->bits[REPORT_OUTPUT] + 7) / 8,
+                   (ri->bits[REPORT_FEATURE] + 7) / 8, (r < job->nreports - 1) ? "," : "");
+        }
+        printf("        ]");
+    }
+    printf("\n      }\n");
+}
+
+/**
+ * "--stress": random mix of reads and writes, as fast as the device takes them,
+ * from a seed that can be given again with "--seed" to replay the same run
+ */
+uint64_t stress_seed = 0;   // "--seed", 0 = pick one from the clock
+
+enum { OP_WRITE, OP_SEND_FEATURE, OP_GET_FEATURE, OP_READ, OP_GET_INPUT, OP_COUNT };
+static const char* op_names[OP_COUNT] =
+    { "write", "send_feature", "get_feature", "read", "get_input" };
+
+#define STRESS_HISTORY 32         // recent operations to show on error
+#define STRESS_GONE_ERRORS 16     // errors in a row that mean device is gone
+
+typedef struct {
+    uint64_t n;
+    int op;
+    uint8_t id;
+    int len;
+    int res;
+    uint64_t usec;
+} stress_op_t;
+
+static uint64_t rng_state;
+
+/**
+ * xorshift64*: small, fast, and the same on every platform
+ */
+uint64_t rng_next(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1Dull;
+}
+
+uint32_t rng_below(uint32_t n)
+{
+    return (uint32_t)((rng_next() >> 32) % n);
+}
+
+void stress_print_history(stress_op_t* hist, uint64_t nops, uint64_t seed)
+{
+    printf("Stress: seed %llu, last %d operations:\n", (unsigned long long)seed,
+           (int)(nops < STRESS_HISTORY ? nops : STRESS_HISTORY));
+    uint64_t first = (nops > STRESS_HISTORY) ? nops - STRESS_HISTORY : 0;
+    for( uint64_t i = first; i < nops; i++ ) {
+        stress_op_t* o = &hist[i % STRESS_HISTORY];
+        printf("  #%llu %-12s id %3d len %4d -> %d (%.3f ms)\n", (unsigned long long)o->n,
+               op_names[o->op], o->id, o->len, o->res, o->usec / 1e3);
+    }
+}
+
+/**
+ * Run random operations against 'dev' for 'secs' seconds.
+ * Report sizes come from the report descriptor if it can be read,
+ * otherwise reportId 0 and lengths up to 'buflen' are used.
+ */
+void stress_run(hid_device* dev, int secs, int buflen)
+{
+    static uint8_t sbuf[MAX_BUF];
+    static stress_op_t history[STRESS_HISTORY];
+    static histogram_t latency[OP_COUNT];
+    uint64_t count[OP_COUNT] = {0}, errors[OP_COUNT] = {0};
+    memset(latency, 0, sizeof(latency));
+
+    // which reports exist for each op, and how long they are (with reportId byte)
+    report_info_t reports[MAX_REPORTS];
+    int nreports = descriptor_reports(descriptorBuf,
+        descriptor_fetch(dev, descriptorBuf, sizeof(descriptorBuf)), reports, MAX_REPORTS);
+    // reports that have each kind, so ops only go to reports that exist
+    report_info_t* of_kind[3][MAX_REPORTS];
+    int nkind[3] = {0};
+    for( int r=0; r<nreports; r++ ) {
+        for( int k=0; k<3; k++ ) {
+            if( reports[r].bits[k] ) of_kind[k][nkind[k]++] = &reports[r];
+        }
+    }
+    if( nreports <= 0 || nkind[REPORT_INPUT] + nkind[REPORT_OUTPUT] + nkind[REPORT_FEATURE] == 0 ) {
+        msg("Stress: no usable report descriptor, using reportId 0 and lengths up to %d\n", buflen);
+        nreports = 1;
+        reports[0].id = 0;
+        reports[0].bits[REPORT_INPUT] = reports[0].bits[REPORT_OUTPUT] =
+            reports[0].bits[REPORT_FEATURE] = (buflen - 1) * 8;
+        for( int k=0; k<3; k++ ) {
+            of_kind[k][0] = &reports[0];
+            nkind[k] = 1;
+        }
+    }
+
+    uint64_t seed = stress_seed ? stress_seed : now_nsec();
+    rng_state = seed ? seed : 1;
+    msg("Stress: %d seconds, seed %llu, %d report%s from descriptor\n", secs,
+        (unsigned long long)seed, nreports, nreports == 1 ? "" : "s");
+
+    uint64_t nops = 0;
+    int errors_in_row = 0;
+    bool dumped = false;
+    uint64_t start = now_nsec(), end = start + (uint64_t)secs * 1000000000ull;
+    while( !stop_requested && now_nsec() < end ) {
+        int op = rng_below(OP_COUNT);
+        int kind = (op == OP_WRITE) ? REPORT_OUTPUT :
+                   (op == OP_READ || op == OP_GET_INPUT) ? REPORT_INPUT : REPORT_FEATURE;
+        if( nkind[kind] == 0 ) continue;  // device has no report of this kind
+        report_info_t* r = of_kind[kind][rng_below(nkind[kind])];
+        int maxlen = (r->bits[kind] + 7) / 8 + 1;  // +1 for reportId byte
+        if( maxlen > MAX_BUF ) maxlen = MAX_BUF;
+        int len = 1 + rng_below(maxlen);
+        for( int i=0; i<len; i++ ) sbuf[i] = rng_next() >> 56;
+        sbuf[0] = r->id;
+
+        uint64_t t0 = now_nsec();
+        int res;
+        switch(op) {
+        case OP_WRITE:        res = hid_write(dev, sbuf, len); break;
+        case OP_SEND_FEATURE: res = hid_send_feature_report(dev, sbuf, len); break;
+        case OP_GET_FEATURE:  res = hid_get_feature_report(dev, sbuf, len); break;
+        case OP_READ:         res = hid_read_timeout(dev, sbuf, len, 0); break;
+        default:              res = hid_get_input_report(dev, sbuf, len); break;
+        }
+        uint64_t usec = (now_nsec() - t0) / 1000;
+
+        stress_op_t* o = &history[nops % STRESS_HISTORY];
+        o->n = nops++; o->op = op; o->id = r->id; o->len = len; o->res = res; o->usec = usec;
+        count[op]++;
+        hist_add(&latency[op], usec);
+        if( res < 0 ) {
+            errors[op]++;
+            errors_in_row++;
+            if( !dumped ) {  // show how we got to the first error
+                msg("Stress: first error on %s: %ls\n", op_names[op], hid_error(dev));
+                stress_print_history(history, nops, seed);
+                dumped = true;
+            }
+            if( errors_in_row >= STRESS_GONE_ERRORS ) {
+                printf("Stress: %d errors in a row, device gone?\n", errors_in_row);
+                stress_print_history(history, nops, seed);
+                break;
+            }
+        } else {
+            errors_in_row = 0;
+        }
+    }
+
+    double elapsed = (now_nsec() - start) / 1e9;
+    printf("Stress: %llu operations in %.3f s (%.0f ops/sec), seed %llu\n", (unsigned long long)nops,
+           elapsed, elapsed > 0 ? nops / elapsed : 0.0, (unsigned long long)seed);
+    printf("Stress: %-12s %10s %8s %7s %10s %10s %10s %10s\n",
+           "operation", "count", "errors", "err%", "mean ms", "p50 ms", "p99 ms", "max ms");
+    for( int op=0; op<OP_COUNT; op++ ) {
+        histogram_t* h = &latency[op];
+        printf("Stress: %-12s %10llu %8llu %6.2f%% %10.3f %10.3f %10.3f %10.3f\n", op_names[op],
+               (unsigned long long)count[op], (unsigned long long)errors[op],
+               count[op] ? 100.0 * errors[op] / count[op] : 0.0, h->mean / 1e3,
+               hist_percentile(h, 50) / 1e3, hist_percentile(h, 99) / 1e3, h->max / 1e3);
+    }
+}
+
+/**
+ * "--bench-sweep": time a fixed number of transfers of each kind at
+ * each report length, and print a CSV row per (kind, length)
+ */
+int bench_count = 100;      // "--bench-count", transfers per row
+
+#define BENCH_DEFAULT_LENGTHS "1,2,4,8,16,32,64,128,256,512,1024"
+
+enum { BENCH_OUTPUT, BENCH_SET_FEATURE, BENCH_GET_FEATURE, BENCH_GET_INPUT, BENCH_KINDS };
+static const char* bench_names[BENCH_KINDS] =
+    { "output", "set_feature", "get_feature", "get_input" };
+static const int bench_report_kind[BENCH_KINDS] =
+    { REPORT_OUTPUT, REPORT_FEATURE, REPORT_FEATURE, REPORT_INPUT };
+
+/**
+ * Parse a list of lengths like "8,16,32", "1-64" or "8-64:8" into 'lens'.
+ * Returns number of lengths, or -1 if list is bad
+ */
+int bench_parse_lengths(const char* spec, int* lens, int max)
+{
+    int n = 0;
+    const char* p = spec;
+    while( *p ) {
+        char* end;
+        int a = strtol(p, &end, 10), b = a, step = 1;
+        if( end == p ) return -1;
+        p = end;
+        if( *p == '-' ) {
+            b = strtol(p+1, &end, 10);
+            if( end == p+1 ) return -1;
+            p = end;
+            if( *p == ':' ) {
+                step = strtol(p+1, &end, 10);
+                if( end == p+1 ) return -1;
+                p = end;
+            }
+        }
+        if( a < 1 || b > MAX_BUF || a > b || step < 1 ) return -1;
+        for( int len = a; len <= b; len += step ) {
+            if( n == max ) return -1;
+            lens[n++] = len;
+        }
+        if( *p == ',' ) p++;
+        else if( *p ) return -1;
+    }
+    return n;
+}
+
+void bench_sweep(hid_device* dev, const char* spec)
+{
+    static uint8_t bbuf[MAX_BUF];
+    static histogram_t h;
+    int lens[MAX_BUF];
+    int nlens = bench_parse_lengths(spec, lens, MAX_BUF);
+
+    // use the first reportId of each kind the descriptor has, else 0
+    report_info_t reports[MAX_REPORTS];
+    int nreports = descriptor_reports(descriptorBuf,
+        descriptor_fetch(dev, descriptorBuf, sizeof(descriptorBuf)), reports, MAX_REPORTS);
+    uint8_t ids[3] = {0, 0, 0};
+    for( int k=2; k>=0; k-- ) {
+        for( int r=nreports-1; r>=0; r-- ) {
+            if( reports[r].bits[k] ) ids[k] = reports[r].id;
+        }
+    }
+    msg("Bench sweep: %d lengths, %d transfers each, reportIds %d (in) %d (out) %d (feature)\n",
+        nlens, bench_count, ids[REPORT_INPUT], ids[REPORT_OUTPUT], ids[REPORT_FEATURE]);
+
+    printf("kind,length,count,errors,seconds,reports_per_sec,bytes_per_sec,"
+           "mean_us,p50_us,p90_us,p99_us,max_us\n");
+    for( int k=0; k<BENCH_KINDS && !stop_requested; k++ ) {
+        for( int l=0; l<nlens && !stop_requested; l++ ) {
+            int len = lens[l];
+            int errors = 0;
+            uint64_t bytes = 0;
+            memset(&h, 0, sizeof(h));
+            uint64_t start = now_nsec();
+            for( int i=0; i<bench_count && !stop_requested; i++ ) {
+                memset(bbuf, 0, len);
+                bbuf[0] = ids[bench_report_kind[k]];
+                if( len > 1 ) { bbuf[1] = i; }  // vary the payload a little
+                uint64_t t = now_nsec();
+                int res;
+                switch(k) {
+                case BENCH_OUTPUT:      res = hid_write(dev, bbuf, len); break;
+                case BENCH_SET_FEATURE: res = hid_send_feature_report(dev, bbuf, len); break;
+                case BENCH_GET_FEATURE: res = hid_get_feature_report(dev, bbuf, len); break;
+                default:                res = hid_get_input_report(dev, bbuf, len); break;
+                }
+                if( res < 0 ) { errors++; continue; }
+                hist_add(&h, (now_nsec() - t) / 1000);
+                bytes += res;
+            }
+            double secs = (now_nsec() - start) / 1e9;
+            uint64_t ok = h.count;
+            printf("%s,%d,%llu,%d,%.6f,%.1f,%.1f,%.1f,%llu,%llu,%llu,%llu\n", bench_names[k], len,
+                   (unsigned long long)(ok + errors), errors, secs,
+                   secs > 0 ? ok / secs : 0.0, secs > 0 ? bytes / secs : 0.0, h.mean,
+                   (unsigned long long)hist_percentile(&h, 50), (unsigned long long)hist_percentile(&h, 90),
+                   (unsigned long long)hist_percentile(&h, 99), (unsigned long long)h.max);
+        }
+    }
+}
+
+/**
+ * "--rt" and "--cpu": settings for low-jitter timing of read loops.
+ * Only Linux is supported; elsewhere they report that they did nothing.
+ */
+int rt_priority = 0;    // SCHED_FIFO priority, 0 = don't use realtime
+int rt_cpu = -1;        // CPU to pin to, -1 = don't pin
+
+#define RT_PREFAULT_STACK (256*1024)
+
+/**
+ * Touch a chunk of stack now so it doesn't page-fault later
+ */
+void rt_prefault_stack(void)
+{
+    volatile uint8_t stack[RT_PREFAULT_STACK];
+    for( size_t i=0; i<sizeof(stack); i += 1024 ) {
+        stack[i] = 0;
+    }
+}
+
+/**
+ * Apply realtime settings and say whether each one took effect
+ */
+void rt_setup(void)
+{
+    if( rt_cpu >= 0 ) {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if( rt_cpu < CPU_SETSIZE ) { CPU_SET(rt_cpu, &set); }
+        if( sched_setaffinity(0, sizeof(set), &set) == 0 ) {
+            msg("Realtime: pinned to CPU %d: ok\n", rt_cpu);
+        } else {
+            msg("Realtime: pinned to CPU %d: failed (%s)\n", rt_cpu, strerror(errno));
+        }
+#else
+        msg("Realtime: --cpu is not supported on this platform\n");
+#endif
+    }
+    if( rt_priority > 0 ) {
+#ifdef __linux__
+        struct sched_param param = { .sched_priority = rt_priority };
+        if( sched_setscheduler(0, SCHED_FIFO, &param) == 0 ) {
+            msg("Realtime: SCHED_FIFO priority %d: ok\n", rt_priority);
+        } else {
+            msg("Realtime: SCHED_FIFO priority %d: failed (%s)\n", rt_priority, strerror(errno));
+        }
+        if( mlockall(MCL_CURRENT | MCL_FUTURE) == 0 ) {
+            msg("Realtime: mlockall: ok\n");
+        } else {
+            msg("Realtime: mlockall: failed (%s)\n", strerror(errno));
+        }
+        rt_prefault_stack();
+        memset(buf, 0, sizeof(buf));
+        memset(descriptorBuf, 0, sizeof(descriptorBuf));
+        msg("Realtime: prefaulted %d kB of stack and buffers\n",
+            (int)((RT_PREFAULT_STACK + sizeof(buf) + sizeof(descriptorBuf)) / 1024));
+#else
+        msg("Realtime: --rt is not supported on this platform\n");
+#endif
+    }
+}
+
+/**
+ * Put the run state back to how a fresh process would start
+ */
+void state_reset(void)
+{
+    timeout_millis = 250;
+    vid = pid = usage_page = usage = 0;
+    serial_wstr[0] = L'\0';
+    print_base = 16;
+    print_width = 32;
+    batch_max = 0;
+    file_binary = false;
+    pipe_window = 1;
+    pipe_tag_out = pipe_tag_in = 1;
+    pipe_retries = 0;
+    pipe_compare = false;
+    stress_seed = 0;
+    bench_count = 100;
+    reconnect_secs = -1;
+}
+
+/**
+ * Append a command to the plan, returning it for the caller to fill in
+ */
+command_t* plan_add(int cmd, char* arg)
+{
+    plan = realloc(plan, (plan_len + 1) * sizeof(command_t));
+    command_t* c = &plan[plan_len++];
+    memset(c, 0, sizeof(command_t));
+    c->cmd = cmd;
+    c->arg = arg;
+    return c;
+}
+
+void plan_free(void)
+{
+    for( int i=0; i<plan_len; i++ ) {
+        free(plan[i].data);
+    }
+    free(plan);
+    plan = NULL;
+    plan_len = 0;
+}
+
+/**
+ * Parse a number that may be given as decimal, 0x-hex, or bare hex "ABCD"
+ */
+uint16_t parse_hex16(char* s)
+{
+    uint16_t v = strtol(s, NULL, 0);
+    if( v == 0 ) {             // if bad parse
+        sscanf(s, "%4hx", &v); // try bare "ABCD"
+    }
+    return v;
+}
+
+/**
+ * Parse argv into 'plan' without touching any device.
+ * Lengths and payloads are resolved here, so running the plan
+ * (possibly many times) does no string parsing.
+ * On an invalid command, prints an error and stops parsing there.
+ * Returns 0 on success, -1 if the plan was cut short.
+ */
+int plan_parse(int argc, char* argv[])
+{
+    int cmd = CMD_NONE;
+    int buflen = 64;  // length of buf in use, as it will be when each command runs
+    uint8_t* last_send_output = NULL;  // request template for --pipeline
+    int last_send_output_len = 0;
+    uint8_t* last_send_feature = NULL; // report for "--duplex feature:rate:..."
+    int last_send_feature_len = 0;
+
+    struct option longoptions[] =
+        {
+         {"help", no_argument, 0, 'h'},
+         {"version",      no_argument, &cmd,         CMD_VERSION},
+         {"verbose",      no_argument, 0,            'v'},
+         {"quiet",        optional_argument, 0,      'q'},
+         {"timeout",      required_argument, 0,      't'},
+         {"length",       required_argument, 0,      'l'},
+         {"buflen",       required_argument, 0,      'l'},
+         {"base",         required_argument, 0,      'b'},
+         {"width",        required_argument, 0,      'w'},
+         {"vidpid",       required_argument, &cmd,   CMD_VIDPID},
+         {"usage",        required_argument, &cmd,   CMD_USAGE},
+         {"usagePage",    required_argument, &cmd,   CMD_USAGEPAGE},
+         {"serial",       required_argument, &cmd,   CMD_SERIALNUMBER},
+         {"list",         no_argument,       &cmd,   CMD_LIST},
+         {"list-usages",  no_argument,       &cmd,   CMD_LIST_USAGES},
+         {"list-detail",  no_argument,       &cmd,   CMD_LIST_DETAIL},
+         {"list-json",    no_argument,       &cmd,   CMD_LIST_JSON},
+         {"list-descriptors", optional_argument, &cmd, CMD_LIST_DESCRIPTORS},
+         {"open",         no_argument,       &cmd,   CMD_OPEN},
+         {"open-path",    required_argument, &cmd,   CMD_OPEN_PATH},
+         {"close",        no_argument,       &cmd,   CMD_CLOSE},
+         {"send-output",  required_argument, &cmd,   CMD_SEND_OUTPUT},
+         {"send-out",     required_argument, &cmd,   CMD_SEND_OUTPUT},
+         {"send-feature", required_argument, &cmd,   CMD_SEND_FEATURE},
+         {"read-input",   no_argument,       &cmd,   CMD_READ_INPUT},
+         {"read-in",      no_argument,       &cmd,   CMD_READ_INPUT},
+         {"read-input-report", required_argument, &cmd,  CMD_READ_INPUT_REPORT},
+         {"read-feature", required_argument, &cmd,   CMD_READ_FEATURE},
+         {"read-input-forever",  optional_argument, &cmd,   CMD_READ_INPUT_FOREVER},
+         {"read-input-report-forever",  required_argument, &cmd,   CMD_READ_INPUT_REPORT_FOREVER},
+         {"get-report-descriptor", no_argument, &cmd, CMD_GET_REPORT_DESCRIPTOR},
+         {"descriptor-file", required_argument, &cmd, CMD_DESCRIPTOR_FILE},
+         {"shm",          required_argument, &cmd,   CMD_SHM},
+         {"seq",          required_argument, &cmd,   CMD_SEQ},
+         {"batch",        required_argument, &cmd,   CMD_BATCH},
+         {"timestamps",   optional_argument, &cmd,   CMD_TIMESTAMPS},
+         {"summarize",    required_argument, &cmd,   CMD_SUMMARIZE},
+         {"split-by-report-id", required_argument, &cmd, CMD_SPLIT},
+         {"verify-crc",   required_argument, &cmd,   CMD_VERIFY_CRC},
+         {"crc-failures-only", no_argument,  &cmd,   CMD_CRC_FAILURES_ONLY},
+         {"expect",       required_argument, &cmd,   CMD_EXPECT},
+         {"reconnect",    optional_argument, &cmd,   CMD_RECONNECT},
+         {"step",         required_argument, &cmd,   CMD_STEP},
+         {"send-output-file",  required_argument, &cmd,  CMD_SEND_OUTPUT_FILE},
+         {"send-feature-file", required_argument, &cmd,  CMD_SEND_FEATURE_FILE},
+         {"read-input-file", required_argument, &cmd,    CMD_READ_INPUT_FILE},
+         {"file-format",  required_argument, &cmd,   CMD_FILE_FORMAT},
+         {"pipeline",     required_argument, &cmd,   CMD_PIPELINE},
+         {"duplex",       required_argument, &cmd,   CMD_DUPLEX},
+         {"read-all-interfaces", optional_argument, &cmd, CMD_READ_ALL_INTERFACES},
+         {"window",       required_argument, &cmd,   CMD_WINDOW},
+         {"tag-offset",   required_argument, &cmd,   CMD_TAG_OFFSET},
+         {"retries",      required_argument, &cmd,   CMD_RETRIES},
+         {"pipeline-compare", no_argument,   &cmd,   CMD_PIPELINE_COMPARE},
+         {"stress",       required_argument, &cmd,   CMD_STRESS},
+         {"seed",         required_argument, &cmd,   CMD_SEED},
+         {"bench-sweep",  optional_argument, &cmd,   CMD_BENCH_SWEEP},
+         {"bench-count",  required_argument, &cmd,   CMD_BENCH_COUNT},
+         {"rt",           optional_argument, &cmd,   CMD_RT},
+         {"cpu",          required_argument, &cmd,   CMD_CPU},
+         {"trace",        required_argument, &cmd,   CMD_TRACE},
+         {"cache",        no_argument,       &cmd,   CMD_CACHE},
+         {"no-cache",     no_argument,       &cmd,   CMD_NO_CACHE},
+         {"refresh-cache", no_argument,      &cmd,   CMD_REFRESH_CACHE},
+         {"repeat",       required_argument, &cmd,   CMD_REPEAT},
+         {"repeat-for",   required_argument, &cmd,   CMD_REPEAT_FOR},
+         {NULL,0,0,0}
+        };
+    char* shortopts = "vht:l:qb:w:";
+
+    int option_index = 0, opt;
+    while( (opt = getopt_long(argc, argv, shortopts, longoptions, &option_index)) != -1 ) {
+        command_t* c;
+        switch(opt) {
+        case 0:                   // long opts with no short opts
+            if( cmd == CMD_REPEAT ) {
+                int n = strtol(optarg,NULL,10);
+                if( n <= 0 ) {
+                    msg("Error: repeat count must be greater than 0.\n");
+                    return -1;
+                }
+                repeat_count = n;
+                break;
+            }
+            if( cmd == CMD_REPEAT_FOR ) {
+                double secs = strtod(optarg,NULL);
+                if( secs <= 0 ) {
+                    msg("Error: repeat time must be greater than 0.\n");
+                    return -1;
+                }
+                repeat_seconds = secs;
+                if( repeat_count == 1 ) { repeat_count = 0; } // 0 = until time is up
+                break;
+            }
+            if( cmd == CMD_RT ) {
+                rt_priority = (optarg) ? strtol(optarg,NULL,10) : 50;
+                if( rt_priority < 1 || rt_priority > 99 ) {
+                    msg("Error: --rt priority must be between 1 and 99.\n");
+                    rt_priority = 0;
+                    return -1;
+                }
+                break;
+            }
+            if( cmd == CMD_CPU ) {
+                rt_cpu = strtol(optarg,NULL,10);
+                if( rt_cpu < 0 ) {
+                    msg("Error: --cpu must be 0 or greater.\n");
+                    return -1;
+                }
+                break;
+            }
+            if( cmd == CMD_TRACE ) {
+                trace_file = optarg;
+                if( !trace_events ) {
+                    trace_events = calloc(TRACE_MAX_EVENTS, sizeof(trace_event_t));
+                    trace_start_ns = now_nsec();
+                }
+                break;
+            }
+            if( cmd == CMD_CACHE || cmd == CMD_NO_CACHE || cmd == CMD_REFRESH_CACHE ) {
+                desc_cache_mode = (cmd == CMD_CACHE)    ? DESC_CACHE_ON :
+                                  (cmd == CMD_NO_CACHE) ? DESC_CACHE_OFF : DESC_CACHE_REFRESH;
+                break;
+            }
+            command_t nc = { .cmd = cmd, .arg = optarg, .buflen = buflen };
+            c = &nc;  // only added to the plan once its argument checks out
+            if( cmd == CMD_VIDPID ) {
+                uint16_t v = 0, p = 0;
+                if( sscanf(optarg, "%6hx/%6hx", &v,&p) !=2 ) {  // match "23FE/AB12" or "0x23FE/0xAB12"
+                    if( !sscanf(optarg, "%6hx:%6hx", &v,&p) ) { // match "23FE:AB12" or "0x23FE:0xAB12"
+                        // else try parsing standard dec/hex values
+                        int wordbuf[4]; // a little extra space
+                        char tmp[MAX_STR];
+                        strncpy(tmp, optarg, MAX_STR-1); tmp[MAX_STR-1] = '\0';
+                        str2buf(wordbuf, ":/, ", tmp, sizeof(wordbuf), 2);
+                        v = wordbuf[0]; p = wordbuf[1];
+                    }
+                }
+                c->num = v; c->num2 = p;
+            }
+            else if( cmd == CMD_USAGEPAGE || cmd == CMD_USAGE ) {
+                c->num = parse_hex16(optarg);
+            }
+            else if( cmd == CMD_SEND_OUTPUT || cmd == CMD_SEND_FEATURE ) {
+                uint8_t tmpbuf[MAX_BUF];
+                char tmp[MAX_STR*4];
+                strncpy(tmp, optarg, sizeof(tmp)-1); tmp[sizeof(tmp)-1] = '\0';
+                int parsedlen = str2buf(tmpbuf, ", ", tmp, sizeof(tmpbuf), 1);
+                if( parsedlen<1 ) { // no bytes or error
+                    msg("Error: no bytes read as arg to --send...\n");
+                    return -1;
+                }
+                buflen = (!buflen) ? parsedlen : buflen;
+                c->buflen = buflen;
+                c->data = calloc(buflen, 1);
+                memcpy(c->data, tmpbuf, (parsedlen < buflen) ? parsedlen : buflen);
+                if( cmd == CMD_SEND_OUTPUT ) {
+                    last_send_output = c->data;
+                    last_send_output_len = buflen;
+                } else {
+                    last_send_feature = c->data;
+                    last_send_feature_len = buflen;
+                }
+            }
+            else if( cmd == CMD_PIPELINE ) {
+                c->num = strtol(optarg,NULL,10);
+                if( c->num <= 0 ) {
+                    msg("Error: --pipeline count must be greater than 0.\n");
+                    return -1;
+                }
+                if( !last_send_output || !buflen ) {
+                    msg("Error: --pipeline needs a --send-output before it as the request.\n");
+                    return -1;
+                }
+                c->data = calloc(buflen, 1);
+                memcpy(c->data, last_send_output,
+                       (last_send_output_len < buflen) ? last_send_output_len : buflen);
+            }
+            else if( cmd == CMD_DUPLEX ) {
+                bool feature = (strncmp(optarg, "feature:", 8) == 0);
+                char* src = optarg + (feature ? 8 : 0);
+                if( !buflen ) {
+                    msg("Error: --duplex needs a report length. Use --len to specify.\n");
+                    return -1;
+                }
+                if( strncmp(src, "rate:", 5) == 0 ) {
+                    long count = 0;
+                    if( sscanf(src+5, "%d:%ld", &c->num, &count) < 1 || c->num <= 0 || count < 0 ) {
+                        msg("Error: --duplex rate needs rate:<hz>[:<count>].\n");
+                        return -1;
+                    }
+                    c->num2 = count;
+                    uint8_t* report = feature ? last_send_feature : last_send_output;
+                    int len = feature ? last_send_feature_len : last_send_output_len;
+                    if( !report ) {
+                        msg("Error: --duplex rate needs a --send-%s before it as the report.\n",
+                            feature ? "feature" : "output");
+                        return -1;
+                    }
+                    c->data = calloc(buflen, 1);
+                    memcpy(c->data, report, (len < buflen) ? len : buflen);
+                }
+            }
+            else if( cmd == CMD_READ_ALL_INTERFACES ) {
+                c->num = (optarg) ? strtol(optarg,NULL,10) : MERGE_WINDOW_MS;
+                if( c->num < 0 ) {
+                    msg("Error: --read-all-interfaces reorder window can't be negative.\n");
+                    return -1;
+                }
+            }
+            else if( cmd == CMD_WINDOW ) {
+                c->num = strtol(optarg,NULL,10);
+                if( c->num < 1 || c->num > 128 ) {
+                    msg("Error: --window must be between 1 and 128.\n");
+                    return -1;
+                }
+            }
+            else if( cmd == CMD_TAG_OFFSET ) {
+                int n = sscanf(optarg, "%d:%d", &c->num, &c->num2);
+                if( n == 1 ) c->num2 = c->num;
+                if( n < 1 || c->num < 0 || c->num2 < 0 || c->num >= MAX_BUF || c->num2 >= MAX_BUF ) {
+                    msg("Error: --tag-offset needs <out[:in]> byte offsets.\n");
+                    return -1;
+                }
+            }
+            else if( cmd == CMD_LIST_DESCRIPTORS ) {
+                c->num = (optarg) ? strtol(optarg,NULL,10) : LIST_TIMEOUT_MS;
+                if( c->num <= 0 ) {
+                    msg("Error: --list-descriptors timeout must be greater than 0 msec.\n");
+                    return -1;
+                }
+            }
+            else if( cmd == CMD_EXPECT ) {
+                uint8_t tmpbuf[MAX_BUF];
+                char tmp[MAX_STR*4];
+                char* colon = strchr(optarg, ':');
+                char* end;
+                c->num = strtol(optarg,&end,0);
+                if( end != colon ) colon = NULL;  // offset isn't a number
+                if( colon ) {
+                    strncpy(tmp, colon+1, sizeof(tmp)-1); tmp[sizeof(tmp)-1] = '\0';
+                    c->num2 = str2buf(tmpbuf, ", ", tmp, sizeof(tmpbuf), 1);
+                }
+                if( !colon || c->num < 0 || c->num >= MAX_BUF || c->num2 < 1 ) {
+                    msg("Error: --expect needs <offset:bytes>, e.g. 1:0x61,0x62\n");
+                    return -1;
+                }
+                c->data = malloc(c->num2);
+                memcpy(c->data, tmpbuf, c->num2);
+            }
+            else if( cmd == CMD_RECONNECT ) {
+                c->num = (optarg) ? strtol(optarg,NULL,10) : 0;
+                if( c->num < 0 ) {
+                    msg("Error: --reconnect time must be 0 (forever) or greater.\n");
+                    return -1;
+                }
+            }
+            else if( cmd == CMD_STEP ) {
+                c->num = steps_len;
+                steps = realloc(steps, (steps_len + 1) * sizeof(step_t));
+                memset(&steps[steps_len], 0, sizeof(step_t));
+                steps[steps_len++].name = optarg;
+            }
+            else if( cmd == CMD_SPLIT ) {
+                if( strlen(optarg) >= MAX_STR - 16 ) {
+                    msg("Error: --split-by-report-id path too long.\n");
+                    return -1;
+                }
+                if( strchr(optarg, '%') && !split_pattern_ok(optarg) ) {
+                    msg("Error: --split-by-report-id pattern needs one %%d or %%x for the reportId.\n");
+                    return -1;
+                }
+            }
+            else if( cmd == CMD_VERIFY_CRC ) {
+                crc_t tmp;
+                if( !crc_parse(optarg, &tmp) ) {
+                    msg("Error: --verify-crc needs <crc8|crc16|crc32|sum>:<start>-<end>:<offset>[:be].\n");
+                    return -1;
+                }
+            }
+            else if( cmd == CMD_SUMMARIZE ) {
+                c->num = strtol(optarg,NULL,10);
+                if( c->num <= 0 ) {
+                    msg("Error: --summarize window must be greater than 0 msec.\n");
+                    return -1;
+                }
+            }
+            else if( cmd == CMD_STRESS ) {
+                c->num = strtol(optarg,NULL,10);
+                if( c->num <= 0 ) {
+                    msg("Error: --stress time must be greater than 0.\n");
+                    return -1;
+                }
+            }
+            else if( cmd == CMD_SEED ) {
+                c->arg = optarg;
+            }
+            else if( cmd == CMD_BENCH_SWEEP ) {
+                int lens[MAX_BUF];
+                c->arg = (optarg) ? optarg : BENCH_DEFAULT_LENGTHS;
+                if( bench_parse_lengths(c->arg, lens, MAX_BUF) <= 0 ) {
+                    msg("Error: --bench-sweep lengths must be like 8,16,32 or 1-64 or 8-64:8, up to %d.\n",
+                        MAX_BUF);
+                    return -1;
+                }
+            }
+            else if( cmd == CMD_BENCH_COUNT ) {
+                c->num = strtol(optarg,NULL,10);
+                if( c->num <= 0 ) {
+                    msg("Error: --bench-count must be greater than 0.\n");
+                    return -1;
+                }
+            }
+            else if( cmd == CMD_RETRIES ) {
+                c->num = strtol(optarg,NULL,10);
+                if( c->num < 0 ) {
+                    msg("Error: --retries must be 0 or greater.\n");
+                    return -1;
+                }
+            }
+            else if( cmd == CMD_READ_INPUT_REPORT ||
+                     cmd == CMD_READ_INPUT_REPORT_FOREVER ||
+                     cmd == CMD_READ_FEATURE ) {
+                c->num = (optarg) ? strtol(optarg,NULL,0) : 0;
+            }
+            else if( cmd == CMD_FILE_FORMAT ) {
+                if( strcmp(optarg, "hex") && strcmp(optarg, "bin") ) {
+                    msg("Error: --file-format must be 'hex' or 'bin'.\n");
+                    return -1;
+                }
+                c->num = (strcmp(optarg, "bin") == 0);
+            }
+            else if( cmd == CMD_TIMESTAMPS ) {
+                c->num = (optarg) ? strtol(optarg,NULL,10) : 0;
+                if( c->num < 0 ) {
+                    msg("Error: --timestamps threshold must be 0 or greater.\n");
+                    return -1;
+                }
+            }
+            else if( cmd == CMD_BATCH ) {
+                c->num = strtol(optarg,NULL,10);
+                if( c->num < 0 || c->num > 4096 ) {
+                    msg("Error: --batch must be between 0 and 4096.\n");
+                    return -1;
+                }
+            }
+            else if( cmd == CMD_SEQ ) {
+                if( sscanf(optarg, "%d:%d", &c->num, &c->num2) != 2 ||
+                    c->num < 0 || c->num >= MAX_BUF ||
+                    (c->num2 != 1 && c->num2 != 2 && c->num2 != 4) ) {
+                    msg("Error: --seq needs <offset:width>, width of 1, 2, or 4 bytes.\n");
+                    return -1;
+                }
+            }
+            *plan_add(nc.cmd, nc.arg) = nc;
+            break; // case 0 (longopts without shortops)
+        case 'h':
+            plan_add(CMD_HELP, NULL);
+            break;
+        case 'l':
+            buflen = strtol(optarg,NULL,10);
+            if( buflen < 0 || buflen > MAX_BUF ) {
+                msg("Error: length must be between 0 and %d.\n", MAX_BUF);
+                return -1;
+            }
+            plan_add(CMD_LENGTH, optarg)->buflen = buflen;
+            break;
+        case 't':
+            plan_add(CMD_TIMEOUT, optarg)->num = strtol(optarg,NULL,10);
+            break;
+        case 'b':
+            plan_add(CMD_BASE, optarg)->num = strtol(optarg,NULL,10);
+            break;
+        case 'w':
+            if( strtol(optarg,NULL,10) <= 0 ) {
                 msg("Error: print width must be greater than 0.\n");
-                done = true;
+                return -1;
             }
+            plan_add(CMD_WIDTH, optarg)->num = strtol(optarg,NULL,10);
             break;
         case 'q':
             msg_quiet = true;
@@ -628,15 +3970,606 @@ int main(int argc, char* argv[])
         case 'v':
             msg_verbose = true;
             break;
+        default:                  // unknown option, getopt has said so
+            return -1;
         } // switch(opt)
+    }
+    return 0;
+}
+
+/**
+ * Run a single command from the plan
+ * Returns 0 to keep going, or a process exit code to stop the plan
+ */
+int run_command(command_t* c)
+{
+    int res;
+    int cmd = c->cmd;
+    int buflen = c->buflen;
+
+    if( cmd == CMD_VIDPID ) {
+        vid = c->num; pid = c->num2;
+        msginfo("Looking for vid/pid 0x%04X / 0x%04X  (%d / %d)\n",vid,pid,vid,pid);
+    }
+    else if( cmd == CMD_USAGEPAGE ) {
+        usage_page = c->num;
+        msginfo("Set usagePage to 0x%04hX (%d)\n", usage_page,usage_page);
+    }
+    else if( cmd == CMD_USAGE ) {
+        usage = c->num;
+        msginfo("Set usage to 0x%04hX (%d)\n", usage,usage);
+    }
+    else if( cmd == CMD_SERIALNUMBER ) {
+
+        mbstowcs( serial_wstr, c->arg, sizeof(serial_wstr)/sizeof(wchar_t));
+    }
+    else if( cmd == CMD_LIST ||
+             cmd == CMD_LIST_USAGES ||
+             cmd == CMD_LIST_DETAIL ) {
+
+        struct hid_device_info *devs, *cur_dev;
+        devs = hid_enumerate(vid,pid); // 0,0 = find all devices
+        if (!devs) {
+            fprintf(stderr, "No HID devices found\n");
+            return 1;
+        }
+
+        cur_dev = devs;
+        while (cur_dev) {
+            if( (!usage_page || cur_dev->usage_page == usage_page) &&
+                (!usage || cur_dev->usage == usage) &&
+                (serial_wstr[0]==L'\0' || wcscmp(cur_dev->serial_number, serial_wstr)==0) ) {
+                if( cmd == CMD_LIST_USAGES ) {
+                    printf("%04X/%04X / %04hX/%04hX  %ls - %ls\n",
+                           cur_dev->vendor_id, cur_dev->product_id,
+                           cur_dev->usage_page, cur_dev->usage ,
+                           cur_dev->manufacturer_string, cur_dev->product_string );
+                }
+                else {
+                    printf("%04X/%04X: %ls - %ls\n",
+                           cur_dev->vendor_id, cur_dev->product_id,
+                           cur_dev->manufacturer_string, cur_dev->product_string );
+                }
 
+                if( cmd == CMD_LIST_DETAIL ) {
+                    printf("  vendorId:      0x%04hX\n", cur_dev->vendor_id);
+                    printf("  productId:     0x%04hX\n", cur_dev->product_id);
+                    printf("  usagePage:     0x%04hX\n", cur_dev->usage_page);
+                    printf("  usage:         0x%04hX\n", cur_dev->usage );
+                    printf("  serial_number: %ls \n", cur_dev->serial_number);
+                    printf("  interface:     %d \n", cur_dev->interface_number);
+                    printf("  bus_type:      %s (%d) \n",
+                           bus_type_name(cur_dev->bus_type), cur_dev->bus_type);
+                    printf("  path: %s\n",cur_dev->path);
+                    printf("\n");
+                }
+            }
+            cur_dev = cur_dev->next;
+        }
+        hid_free_enumeration(devs);
+    }
+    else if( cmd == CMD_LIST_JSON ||
+             cmd == CMD_LIST_DESCRIPTORS ) {
+        struct hid_device_info *devs, *cur_dev;
+        devs = hid_enumerate(vid, pid);
+        if (!devs) {
+            fprintf(stderr, "No HID devices found\n");
+            printf("{\n    \"error\": \"No HID devices found\",\n");
+            printf("    \"devices\": []\n");
+            printf("}\n");
+            return 1;
+        }
+        desc_scan_t* scan = NULL;
+        char** paths = NULL;
+        int npaths = 0;
+        if( cmd == CMD_LIST_DESCRIPTORS ) {  // each path only once, it may have many usages
+            for( cur_dev = devs; cur_dev; cur_dev = cur_dev->next ) {
+                if( !device_matches(cur_dev) ) continue;
+                int i;
+                for( i=0; i<npaths && strcmp(paths[i], cur_dev->path); i++ ) { }
+                if( i < npaths ) continue;
+                paths = realloc(paths, (npaths + 1) * sizeof(char*));
+                paths[npaths++] = cur_dev->path;
+            }
+            scan = desc_scan(paths, npaths, c->num);
+        }
+        printf("{\n  \"devices\": [\n");
+        bool first = true;
+        cur_dev = devs;
+        while (cur_dev) {
+            if( device_matches(cur_dev) ) {
+                if (!first) printf(",\n");
+                first = false;
+                printf("    {\n");
+                printf("      \"vendor_id\": \"0x%04hX\",\n", cur_dev->vendor_id);
+                printf("      \"product_id\": \"0x%04hX\",\n", cur_dev->product_id);
+                printf("      \"usage_page\": \"0x%04hX\",\n", cur_dev->usage_page);
+                printf("      \"usage\": \"0x%04hX\",\n", cur_dev->usage);
+                printf("      \"manufacturer_string\": "); json_print_wstr(cur_dev->manufacturer_string); printf(",\n");
+                printf("      \"product_string\": ");      json_print_wstr(cur_dev->product_string);      printf(",\n");
+                printf("      \"serial_number\": ");       json_print_wstr(cur_dev->serial_number);       printf(",\n");
+                printf("      \"interface_number\": %d,\n", cur_dev->interface_number);
+                printf("      \"bus_type\": \"%d\",\n", cur_dev->bus_type);
+                printf("      \"bus_type_name\": \"%s\",\n", bus_type_name(cur_dev->bus_type));
+                printf("      \"path\": "); json_print_str(cur_dev->path);
+                int i = 0;
+                while( scan && i < npaths && strcmp(paths[i], cur_dev->path) ) i++;
+                if( scan && i < npaths ) {
+                    printf(",\n");
+                    json_print_descriptor(&scan->jobs[i]);
+                } else {
+                    printf("\n");
+                }
+                printf("    }");
+            }
+            cur_dev = cur_dev->next;
+        }
+        printf("\n  ]\n}\n");
+        hid_free_enumeration(devs);
+        free(paths);
+        if( scan ) desc_scan_release(scan);  // timed-out workers hold on to it until they return
+    }
+    else if( cmd == CMD_OPEN ) {
+        if( dev ) {  // don't leak a previously opened device
+            hid_close(dev);
+            dev = NULL;
+        }
+        if( vid && pid && !usage_page && !usage ) {
+            msg("Opening device, vid/pid: 0x%04X/0x%04X\n",vid,pid);
+            dev = hid_open(vid,pid,NULL);
+            if( !dev ) {
+                msg("Error: could not open device\n");
+                op_errors++;
+            }
+            else {  // remember where it was, for --reconnect
+                devpath[0] = '\0';
+                device_remember(dev);
+            }
+        }
+        else {
+            msg("Opening device, vid/pid:0x%04X/0x%04X, usagePage/usage: %X/%X\n",
+                vid,pid,usage_page,usage);
 
-    } // while(!done)
+            if( device_find(devpath) < 0 ) {
+                msg("Error: no HID devices found for given vid/pid\n");
+                return 1;
+            }
+            if( devpath[0] ) {
+                msginfo("Opening device by path: %s\n",devpath);
+                hid_device *handle = hid_open_path(devpath);
+                if (!handle) {
+                    msg("Error: could not open device at path: %s\n",devpath);
+                    msg("Error: %ls\n", hid_error(handle));
+                    return 1;
+                }
+                dev = handle;
+                device_remember(dev);
+                msg("Device opened\n");
+            }
+            else {
+                msg("Error: no matching devices\n");
+                op_errors++;
+            }
+        }
+    }
+    else if( cmd == CMD_OPEN_PATH ) {
+        if( dev ) {
+            hid_close(dev);
+            dev = NULL;
+        }
+        msg("Opening device. path: %s\n",c->arg);
+        strncpy(devpath, c->arg, MAX_STR-1);
+        devpath[MAX_STR-1] = '\0';
+        dev = hid_open_path(c->arg);
+        if( dev==NULL ) {
+            msg("Error: could not open device\n");
+            op_errors++;
+        } else {
+            device_remember(dev);
+        }
+    }
+    else if( cmd == CMD_CLOSE ) {
 
-    if(dev) {
         msg("Closing device\n");
-        hid_close(dev);
+        if(dev) {
+            hid_close(dev);
+            dev = NULL;
+        }
+    }
+    else if( cmd == CMD_GET_REPORT_DESCRIPTOR ) {
+        if( !dev ) {
+            msg("Error on send: no device opened.\n"); op_errors++; return 0;
+        }
+        msg("Report Descriptor:\n");
+        int descriptorLen = descriptor_fetch(dev, descriptorBuf,
+                                             HID_API_MAX_REPORT_DESCRIPTOR_SIZE);
+        printbuf(descriptorBuf, descriptorLen, print_base, print_width);
+    }
+    else if( cmd == CMD_SEND_OUTPUT  ||
+             cmd == CMD_SEND_FEATURE ) {
+
+        if( !dev ) {
+            msg("Error on send: no device opened.\n"); op_errors++; return 0;
+        }
+        if( cmd == CMD_SEND_OUTPUT ) {
+            msg("Writing output report of %d-bytes...",buflen);
+            res = hid_write(dev, c->data, buflen);
+        }
+        else {
+            msg("Writing %d-byte feature report...",buflen);
+            res = hid_send_feature_report(dev, c->data, buflen);
+        }
+        if( res < 0 ) {
+            msg("error: %ls\n", hid_error(dev));
+            op_errors++;
+        } else {
+            msg("wrote %d bytes:\n", res);
+        }
+        if(!msg_quiet) { printbuf(c->data, buflen, print_base, print_width); }
+    }
+    else if( cmd == CMD_READ_INPUT ||
+             cmd == CMD_READ_INPUT_FOREVER ) {
+
+        if( !dev ) {
+            msg("Error on read: no device opened.\n"); op_errors++; return 0;
+        }
+        if( !buflen) {
+            msg("Error on read: buffer length is 0. Use --len to specify.\n"); return 0;
+        }
+        if( batch_max ) {
+            return read_input_batched(dev, buflen, cmd == CMD_READ_INPUT_FOREVER);
+        }
+        do {
+            msg("Reading up to %d-byte input report, %d msec timeout...",
+              buflen, timeout_millis);
+            res = hid_read_timeout(dev, buf, buflen, timeout_millis);
+            input_report_arrived(buf, res, now_nsec());
+            print_read_header(res);
+            if( res < 0 ) {  // error or removed device
+                msg("error: %ls\n", hid_error(dev));
+                op_errors++;
+                if( cmd == CMD_READ_INPUT_FOREVER && reconnect_secs >= 0 && device_reconnect(dev) ) {
+                    continue;
+                }
+                break;
+            } else {
+                if( reports_printed() ) { printbuf(buf,buflen, print_base, print_width); }
+                memset(buf,0,buflen);  // clear it out
+            }
+        } while( cmd == CMD_READ_INPUT_FOREVER && !stop_requested );
+    }
+    else if( cmd == CMD_READ_INPUT_REPORT ||
+             cmd == CMD_READ_INPUT_REPORT_FOREVER ) {
+        if( !dev ) {
+            msg("Error on read: no device opened.\n"); op_errors++; return 0;
+        }
+        if( !buflen) {
+            msg("Error on read: buffer length is 0. Use --len to specify.\n");
+            return 0;
+        }
+        uint8_t report_id = c->num;
+        do {
+            memset(buf, 0, MAX_BUF);
+            buf[0] = report_id;
+            msg("Reading %d-byte input report using hid_get_input_report, report_id %d...",
+                buflen, report_id);
+            res = hid_get_input_report(dev, buf, buflen);
+            input_report_arrived(buf, res, now_nsec());
+            if( res < 0 ) {
+                msg("error: %ls\n", hid_error(dev));
+                op_errors++;
+                if( cmd == CMD_READ_INPUT_REPORT_FOREVER && reconnect_secs >= 0 ) {
+                    if( !device_reconnect(dev) ) break;
+                    continue;
+                }
+            } else {
+                print_read_header(res);
+                if( reports_printed() ) { printbuf(buf, buflen, print_base, print_width); }
+            }
+            // since input report is non-blocking, use timeout_millis
+            sleep_ms(timeout_millis);
+        } while( cmd == CMD_READ_INPUT_REPORT_FOREVER && !stop_requested );
+    }
+    else if( cmd == CMD_READ_FEATURE ) {
+
+        if( !dev ) {
+            msg("Error on read: no device opened.\n"); op_errors++; return 0;
+        }
+        if( !buflen) {
+            msg("Error on read: buffer length is 0. Use --len to specify.\n");
+            return 0;
+        }
+        uint8_t report_id = c->num;
+        memset(buf, 0, MAX_BUF);
+        buf[0] = report_id;
+        msg("Reading %d-byte feature report, report_id %d...",buflen, report_id);
+        res = hid_get_feature_report(dev, buf, buflen);
+        last_report_save(buf, res);
+        if( res <  0 ){
+            msg("error: %ls\n", hid_error(dev));
+            op_errors++;
+        } else {
+            msg("read %d bytes:\n",res);
+            printbuf(buf, buflen, print_base, print_width);
+        }
+    }
+    else if( cmd == CMD_SHM ) {
+        shm_ring_close();
+        if( shm_ring_open(c->arg) == 0 ) {
+            msg("Publishing input reports to shared memory '%s'\n", c->arg);
+        }
+    }
+    else if( cmd == CMD_DESCRIPTOR_FILE ) {
+        if( !descriptor_file_print(c->arg) ) { op_errors++; }
+    }
+    else if( cmd == CMD_READ_INPUT_FILE ) {
+        read_input_file(c->arg, buflen);
+    }
+    else if( cmd == CMD_SEND_OUTPUT_FILE ||
+             cmd == CMD_SEND_FEATURE_FILE ) {
+        if( !dev ) {
+            msg("Error on send: no device opened.\n"); op_errors++; return 0;
+        }
+        send_file(dev, cmd, c->arg, buflen);
+    }
+    else if( cmd == CMD_PIPELINE ) {
+        if( !dev ) {
+            msg("Error on send: no device opened.\n"); op_errors++; return 0;
+        }
+        if( pipe_tag_out >= buflen || pipe_tag_in >= buflen ) {
+            msg("Error: --tag-offset is past the %d-byte report length.\n", buflen);
+            op_errors++; return 0;
+        }
+        msg("Pipelining %d %d-byte requests, window %d, tag at %d/%d, %d msec timeout...\n",
+            c->num, buflen, pipe_window, pipe_tag_out, pipe_tag_in, timeout_millis);
+        pipe_result_t r = pipeline_run(dev, c->data, buflen, c->num, pipe_window);
+        pipeline_print(&r);
+        if( pipe_compare && pipe_window > 1 && !stop_requested ) {  // same again in lockstep
+            pipe_result_t r1 = pipeline_run(dev, c->data, buflen, c->num, 1);
+            pipeline_print(&r1);
+            if( r1.done && r.secs > 0 && r1.secs > 0 ) {
+                printf("Pipeline W=%d is %.2fx the throughput of W=1\n", pipe_window,
+                       (r.done / r.secs) / (r1.done / r1.secs));
+            }
+        }
+    }
+    else if( cmd == CMD_READ_ALL_INTERFACES ) {
+        if( !buflen) {
+            msg("Error on read: buffer length is 0. Use --len to specify.\n"); return 0;
+        }
+        merge_run(buflen, c->num);
+    }
+    else if( cmd == CMD_DUPLEX ) {
+        if( !dev ) {
+            msg("Error on send: no device opened.\n"); op_errors++; return 0;
+        }
+        duplex_run(dev, c, buflen);
+    }
+    else if( cmd == CMD_STRESS ) {
+        if( !dev ) {
+            msg("Error on send: no device opened.\n"); op_errors++; return 0;
+        }
+        stress_run(dev, c->num, buflen);
+    }
+    else if( cmd == CMD_BENCH_SWEEP ) {
+        if( !dev ) {
+            msg("Error on send: no device opened.\n"); op_errors++; return 0;
+        }
+        bench_sweep(dev, c->arg);
+    }
+    else if( cmd == CMD_BENCH_COUNT ) {
+        bench_count = c->num;
+        msginfo("Set bench count to %d\n", bench_count);
+    }
+    else if( cmd == CMD_SEED ) {
+        stress_seed = strtoull(c->arg,NULL,0);
+        msginfo("Set stress seed to %llu\n", (unsigned long long)stress_seed);
+    }
+    else if( cmd == CMD_WINDOW ) {
+        pipe_window = c->num;
+        msginfo("Set pipeline window to %d\n", pipe_window);
+    }
+    else if( cmd == CMD_TAG_OFFSET ) {
+        pipe_tag_out = c->num;
+        pipe_tag_in = c->num2;
+        msginfo("Set tag offset to %d (out) / %d (in)\n", pipe_tag_out, pipe_tag_in);
+    }
+    else if( cmd == CMD_RETRIES ) {
+        pipe_retries = c->num;
+        msginfo("Set pipeline retries to %d\n", pipe_retries);
+    }
+    else if( cmd == CMD_PIPELINE_COMPARE ) {
+        pipe_compare = true;
+        msginfo("Comparing pipeline runs with window 1\n");
+    }
+    else if( cmd == CMD_FILE_FORMAT ) {
+        file_binary = c->num;
+        msginfo("Set file format to %s\n", c->arg);
+    }
+    else if( cmd == CMD_EXPECT ) {
+        expect_check(c->num, c->data, c->num2, c->arg);
+    }
+    else if( cmd == CMD_RECONNECT ) {
+        reconnect_secs = c->num;
+        msginfo("Reconnecting on read errors, giving up after %d sec (0 = never)\n", reconnect_secs);
+    }
+    else if( cmd == CMD_STEP ) {
+        step_begin(c->num);
+    }
+    else if( cmd == CMD_SPLIT ) {
+        if( split_open(c->arg, file_binary) == 0 ) {
+            msginfo("Splitting input reports by reportId into %s\n", c->arg);
+        }
+    }
+    else if( cmd == CMD_VERIFY_CRC ) {
+        crc_parse(c->arg, &crc);
+        crc_init_tables(&crc);
+        crc.enabled = true;
+        msginfo("Verifying %s over bytes %d-%d against %s-endian value at %d\n", crc_names[crc.algo],
+                crc.start, crc.end, crc.big_endian ? "big" : "little", crc.offset);
+    }
+    else if( cmd == CMD_CRC_FAILURES_ONLY ) {
+        crc.failures_only = true;
+    }
+    else if( cmd == CMD_SUMMARIZE ) {
+        summary.enabled = true;
+        summary.window_ns = (uint64_t)c->num * 1000000;
+        summary.nfields = 0;
+        summary.ids = false;
+        if( dev ) {  // summarize by field if the descriptor says what they are
+            int len = descriptor_fetch(dev, descriptorBuf, sizeof(descriptorBuf));
+            int n = descriptor_input_fields(descriptorBuf, len, summary.fields, MAX_FIELDS);
+            for( int i=0; i<n; i++ ) {
+                field_t* f = &summary.fields[i];
+                if( f->id ) summary.ids = true;
+                msg("Summarize: f%d is reportId %d bits %u-%u%s\n", i, f->id, f->bit,
+                    f->bit + f->size - 1, f->is_signed ? " (signed)" : "");
+            }
+            summary.nfields = (n > 0) ? n : 0;
+        }
+        msg("Summarizing input reports %s every %d msec (min/max/mean/variance)\n",
+            summary.nfields ? "by field" : "by byte", c->num);
+    }
+    else if( cmd == CMD_TIMESTAMPS ) {
+        arrivals.enabled = true;
+        arrivals.late_usec = c->num;
+        msginfo("Timestamping input reports, late threshold %d usec\n", c->num);
+    }
+    else if( cmd == CMD_BATCH ) {
+        batch_max = c->num;
+        msginfo("Set batch size to %d\n", batch_max);
+    }
+    else if( cmd == CMD_SEQ ) {
+        seq_config(c->num, c->num2);
+        msginfo("Tracking %d-byte sequence counter at offset %d\n", c->num2, c->num);
+    }
+    else if( cmd == CMD_VERSION ) {
+        printf("hidapitester version: %s\n", HIDAPITESTER_VERSION);
+        printf("hidapi version: %d.%d.%d\n",
+               HID_API_VERSION_MAJOR, HID_API_VERSION_MINOR, HID_API_VERSION_PATCH);
+    }
+    else if( cmd == CMD_HELP ) {
+        print_usage("hidapitester");
+    }
+    else if( cmd == CMD_LENGTH ) {
+        msginfo("Set buflen to %d\n", buflen);
+    }
+    else if( cmd == CMD_TIMEOUT ) {
+        timeout_millis = c->num;
+        msginfo("Set timeout_millis to %d\n", timeout_millis);
+    }
+    else if( cmd == CMD_BASE ) {
+        print_base = c->num;
+        msginfo("Set print_base to %d\n", print_base);
+    }
+    else if( cmd == CMD_WIDTH ) {
+        print_width = c->num;
+        msginfo("Set print_width to %d\n", print_width);
+    }
+    return 0;
+}
+
+/**
+ *
+ */
+int main(int argc, char* argv[])
+{
+    int res = 0;
+
+    setbuf(stdout, NULL);  // turn off buffering of stdout
+
+    if(argc < 2){
+        print_usage( "hidapitester" );
+        exit(1);
+    }
+
+    signal(SIGINT, on_sigint);
+
+    if( spec_expand(&argc, &argv) < 0 ) {
+        exit(1);
+    }
+    if( plan_parse(argc, argv) < 0 ) {
+        int bad = (optind > 1) ? optind - 1 : 1;  // the failed option, or its argument
+        if( spec_origin && bad < argc && spec_origin[bad] ) {
+            msg("Error: test spec line failed to parse: %s\n", spec_origin[bad]);
+        }
+        exit(1);  // nothing has run yet
+    }
+    rt_setup();
+
+    bool repeating = (repeat_count != 1 || repeat_seconds > 0);
+    uint64_t start_ns = now_nsec();
+    uint64_t iter_min = UINT64_MAX, iter_max = 0;
+    int iter;
+    for( iter = 0; repeat_count == 0 || iter < repeat_count; iter++ ) {
+        if( stop_requested ) {
+            break;
+        }
+        if( repeat_seconds > 0 && (now_nsec() - start_ns) >= repeat_seconds * 1e9 ) {
+            break;
+        }
+        uint64_t iter_start = now_nsec();
+        state_reset();
+        for( int i=0; i<plan_len && !res && !stop_requested; i++ ) {
+            res = run_command(&plan[i]);
+        }
+        step_finish(res != 0);
+        if(dev) {
+            msg("Closing device\n");
+            hid_close(dev);
+            dev = NULL;
+        }
+        uint64_t iter_ns = now_nsec() - iter_start;
+        if( iter_ns < iter_min ) iter_min = iter_ns;
+        if( iter_ns > iter_max ) iter_max = iter_ns;
+        if( repeating ) {
+            msg("Iteration %d: %.3f ms\n", iter+1, iter_ns / 1e6);
+        }
+        if( res ) {
+            iter++;
+            break;
+        }
+    }
+
+    if( repeating && iter > 0 ) {
+        double total_ms = (now_nsec() - start_ns) / 1e6;
+        printf("Ran %d iterations in %.3f ms: min %.3f / mean %.3f / max %.3f ms per iteration\n",
+               iter, total_ms, iter_min / 1e6, total_ms / iter, iter_max / 1e6);
+    }
+
+    if( seq.enabled ) {
+        seq_print_stats();
+    }
+    if( batch_stats.wakeups ) {
+        batch_print_stats();
+    }
+    if( arrivals.intervals.count ) {
+        arrivals_print_stats();
+    }
+    if( summary.reports ) {
+        summary_print(true);
+    }
+    if( reconnect_stats.gap_total_ns ) {
+        reconnect_print_stats();
+    }
+    split_close();
+    if( crc.enabled ) {
+        crc_print_stats();
+    }
+    int failed_steps = steps_len ? steps_print_summary() : 0;
+    if( !res && (expect_failures || failed_steps) ) {
+        res = 1;
+    }
+
+    plan_free();
+    shm_ring_close();
+    // a timed-out --list-descriptors worker may still be inside hidapi:
+    // leave it (and the trace buffer) alone, the process is exiting anyway
+    bool workers_left = atomic_load_int(&desc_workers_alive) > 0;
+    if( !workers_left ) {
+        hid_exit();
     }
-    res = hid_exit();
+    trace_flush(!workers_left);
+    return res;
 
 } // main
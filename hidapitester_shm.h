@@ -0,0 +1,158 @@
+/**
+ * hidapitester_shm.h -- Shared-memory input report ring used by "--shm"
+ *
+ * hidapitester publishes every input report it reads into a POSIX
+ * shared-memory object laid out as a header followed by 'slot_count'
+ * fixed-size slots.  Report number 'n' lives in slot 'n % slot_count'.
+ * There is one writer (hidapitester) and any number of lock-free readers.
+ *
+ * Each slot carries a sequence word:  2n+1 while report 'n' is being
+ * written, 2n+2 once it is complete.  A reader copies the slot out and
+ * re-checks the sequence word; if it changed, the writer lapped the reader.
+ *
+ * Minimal consumer:
+ *
+ *   hidapitester_shm_header* ring = hidapitester_shm_attach("/hidin");
+ *   uint64_t next = hidapitester_shm_head(ring);
+ *   for(;;) {
+ *       uint8_t data[HIDAPITESTER_SHM_SLOT_SIZE]; uint64_t ts;
+ *       int len = hidapitester_shm_read(ring, next, data, sizeof(data), &ts);
+ *       if( len == HIDAPITESTER_SHM_EMPTY ) { continue; }  // poll or sleep
+ *       if( len == HIDAPITESTER_SHM_OVERRUN ) { next = hidapitester_shm_head(ring); continue; }
+ *       ... use data[0..len-1], ts ...
+ *       next++;
+ *   }
+ *
+ */
+
+#ifndef HIDAPITESTER_SHM_H
+#define HIDAPITESTER_SHM_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define HIDAPITESTER_SHM_MAGIC     0x48494452u  // "HIDR"
+#define HIDAPITESTER_SHM_VERSION   2            // 2: header is 64 bytes (was 72)
+#define HIDAPITESTER_SHM_SLOTS     1024         // default slot count
+#define HIDAPITESTER_SHM_SLOT_SIZE 1024         // max report bytes per slot (== MAX_BUF)
+
+#define HIDAPITESTER_SHM_EMPTY    (-1)  // requested report not written yet
+#define HIDAPITESTER_SHM_OVERRUN  (-2)  // requested report already overwritten
+
+typedef struct {
+    uint32_t magic;         // HIDAPITESTER_SHM_MAGIC
+    uint32_t version;       // HIDAPITESTER_SHM_VERSION
+    uint32_t slot_count;    // number of slots in the ring
+    uint32_t slot_size;     // max data bytes in each slot
+    uint32_t slot_stride;   // bytes from one slot to the next
+    uint32_t writer_alive;  // 1 while hidapitester is publishing
+    uint64_t head;          // number of reports published so far
+    uint64_t reserved[4];   // pad header to 64 bytes, so slots start on a cache line
+} hidapitester_shm_header;
+
+// compile-time check (C99 has no _Static_assert): slot layout depends on it
+typedef char hidapitester_shm_header_is_64_bytes[(sizeof(hidapitester_shm_header) == 64) ? 1 : -1];
+
+typedef struct {
+    uint64_t seq;           // 2n+1 while writing report n, 2n+2 when done
+    uint64_t timestamp_ns;  // monotonic time right after the read returned
+    uint32_t len;           // bytes of valid data
+    uint32_t reserved;
+    uint64_t reserved2;
+    uint8_t  data[];        // 'slot_size' bytes
+} hidapitester_shm_slot;
+
+static inline uint32_t hidapitester_shm_stride(uint32_t slot_size)
+{
+    return (uint32_t)((sizeof(hidapitester_shm_slot) + slot_size + 63) & ~63u);
+}
+
+static inline size_t hidapitester_shm_size(uint32_t slot_count, uint32_t slot_size)
+{
+    return sizeof(hidapitester_shm_header) + (size_t)hidapitester_shm_stride(slot_size) * slot_count;
+}
+
+static inline hidapitester_shm_slot* hidapitester_shm_slot_at(hidapitester_shm_header* ring, uint64_t n)
+{
+    return (hidapitester_shm_slot*)((uint8_t*)(ring + 1) +
+                                    (size_t)(n % ring->slot_count) * ring->slot_stride);
+}
+
+/**
+ * Number of reports published so far, i.e. sequence number of the next one
+ */
+static inline uint64_t hidapitester_shm_head(hidapitester_shm_header* ring)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Copy report 'n' into 'buf' (up to 'buflen' bytes).
+ * Returns report length, HIDAPITESTER_SHM_EMPTY or HIDAPITESTER_SHM_OVERRUN
+ */
+static inline int hidapitester_shm_read(hidapitester_shm_header* ring, uint64_t n,
+                                        uint8_t* buf, uint32_t buflen, uint64_t* timestamp_ns)
+{
+    hidapitester_shm_slot* slot = hidapitester_shm_slot_at(ring, n);
+    uint64_t want = 2*n + 2;
+    uint64_t s1 = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if( s1 < want ) return HIDAPITESTER_SHM_EMPTY;
+    if( s1 > want ) return HIDAPITESTER_SHM_OVERRUN;
+    uint32_t len = slot->len;
+    if( len > buflen ) len = buflen;
+    memcpy(buf, slot->data, len);
+    if( timestamp_ns ) *timestamp_ns = slot->timestamp_ns;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if( __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != s1 ) return HIDAPITESTER_SHM_OVERRUN;
+    return (int)len;
+}
+
+/**
+ * Writer side: publish one report. Only hidapitester itself calls this.
+ */
+static inline void hidapitester_shm_publish(hidapitester_shm_header* ring,
+                                            const uint8_t* data, uint32_t len, uint64_t timestamp_ns)
+{
+    uint64_t n = ring->head;
+    hidapitester_shm_slot* slot = hidapitester_shm_slot_at(ring, n);
+    if( len > ring->slot_size ) len = ring->slot_size;
+    __atomic_store_n(&slot->seq, 2*n + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->timestamp_ns = timestamp_ns;
+    slot->len = len;
+    memcpy(slot->data, data, len);
+    __atomic_store_n(&slot->seq, 2*n + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->head, n + 1, __ATOMIC_RELEASE);
+}
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Reader side: map an existing ring read-only. Returns NULL on failure.
+ */
+static inline hidapitester_shm_header* hidapitester_shm_attach(const char* name)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if( fd < 0 ) return NULL;
+    struct stat st;
+    void* p = MAP_FAILED;
+    if( fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(hidapitester_shm_header) ) {
+        p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if( p == MAP_FAILED ) return NULL;
+    hidapitester_shm_header* ring = (hidapitester_shm_header*)p;
+    if( ring->magic != HIDAPITESTER_SHM_MAGIC || ring->version != HIDAPITESTER_SHM_VERSION ||
+        (size_t)st.st_size < hidapitester_shm_size(ring->slot_count, ring->slot_size) ) {
+        munmap(p, st.st_size);
+        return NULL;
+    }
+    return ring;
+}
+#endif
+
+#endif // HIDAPITESTER_SHM_H
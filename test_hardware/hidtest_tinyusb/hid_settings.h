@@ -15,6 +15,10 @@ typedef struct
     const uint8_t* desc_hid_report;
     const uint8_t desc_size;
 
+    // Input report sent by the 's' stream generator (in_report_len 0 = none)
+    const uint8_t in_report_id;
+    const uint8_t in_report_len;
+
     // information for us humans using this sketch
     const char* info; 
 } HIDSetting;
@@ -32,6 +36,8 @@ const HIDSetting setting_inout_noid_32 =
  .product_str = "INOUT 32bytes",
  .desc_hid_report = hid_report_inout_noid_32,
  .desc_size = sizeof(hid_report_inout_noid_32),
+ .in_report_id = 0,
+ .in_report_len = 32,
  .info = "IN/OUT reports 32 bytes, no reportIds"
 };
 
@@ -43,6 +49,8 @@ const HIDSetting setting_inout_id_32 =
  .product_str = "INOUT 32bytes rId1",
  .desc_hid_report = hid_report_inout_id_32,
  .desc_size = sizeof(hid_report_inout_id_32),
+ .in_report_id = 1,
+ .in_report_len = 32,
  .info = "IN/OUT reports 32 bytes, with reportId 1"
 };
 
@@ -54,6 +62,8 @@ const HIDSetting setting_teensy =
   .product_str = "FakeTeensy",
   .desc_hid_report = hid_report_teensy,
   .desc_size = sizeof(hid_report_teensy),
+  .in_report_id = 0,
+  .in_report_len = 64,
   .info = "Teensy RAWHID like, 64-byte IN/OUT reports, no reportId"
 };
 
@@ -65,6 +75,8 @@ const HIDSetting setting_blink1 =
  .product_str = "blink(1) in name only",
  .desc_hid_report = hid_report_blink1,
  .desc_size = sizeof(hid_report_blink1),
+ .in_report_id = 0,
+ .in_report_len = 0,
  .info = "blink(1) like, FEATURE reports 1 (8-bytes) and 2 (60-bytes)"
 };
 
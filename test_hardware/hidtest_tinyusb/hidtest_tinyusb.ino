@@ -20,6 +20,8 @@
  *    e N        - set echo mode on (1) or off (0)
  *    i len byte [byte ...]  - send INPUT report to host
  *    f len byte [byte ...]  - send FEATURE report to host
+ *    s N        - stream INPUT reports every N msec (0 = stop), with a
+ *                 32-bit little-endian sequence counter in the first 4 data bytes
  *
  *  For i/f: len = 1 (report ID byte) + number of data bytes.
  *  First byte is the report ID; use 0 if the descriptor has no report IDs.
@@ -39,6 +41,8 @@
  * hidapitester examples:
  *   hidapitester --vidpid 27b8:ee32 -l 32 --open --send-output 1,2,3,4
  *   hidapitester --vidpid 27b8:4444 -l 9 --open --send-feature 1,99,44,22 --read-feature 1
+ *   hidapitester --vidpid 27b8:ee32 -l 32 --seq 0:4 --open --read-input-forever   (after "s 1")
+ *   hidapitester --vidpid 27b8:ee33 -l 33 --seq 1:4 --open --read-input-forever   (report ID first)
  */
 
 #include <Adafruit_TinyUSB.h>
@@ -60,6 +64,10 @@ Adafruit_USBD_HID usb_hid;
 uint32_t statusMillisNext;
 bool echoReports = false;
 
+uint32_t streamMillis = 0;     // 's' stream interval, 0 = off
+uint32_t streamMillisNext;
+uint32_t streamSeq;            // sequence counter put in each streamed report
+
 
 // the setup function runs once when you press reset or power the board
 void setup()
@@ -129,6 +137,7 @@ void print_help()
                  "   - i <len rId d1 d2 d3...>  - send INPUT report to host\n"
                  "   - f <len rId d1 d2 d3...>  - send FEATURE report to host\n"
                  "   - e <n>  - Turn report echo on(n=1)/off(n=0)\n"
+                 "   - s <n>  - Stream INPUT reports w/ sequence counter every n msec (0=off)\n"
                  "   - m <n>   - Select device mode to 0,1,2,3 (causes device reset)\n"
                  "   - c       - Show current device config and available modes\n"
                  "   - ?       - Print this help\n");
@@ -149,6 +158,21 @@ void loop()
         Serial.printf(" vidpid=%04X:%04X\n", setting.vid, setting.pid);
         Serial.println("('?' for help)>");
     }
+
+    // INPUT report generator, for checking hidapitester "--seq"
+    if( streamMillis && setting.in_report_len &&
+        (int32_t)(millis() - streamMillisNext) >= 0 && usb_hid.ready() ) {
+        streamMillisNext = millis() + streamMillis;
+        uint8_t report[64];
+        memset(report, 0, sizeof(report));
+        report[0] = streamSeq & 0xff;
+        report[1] = (streamSeq >> 8) & 0xff;
+        report[2] = (streamSeq >> 16) & 0xff;
+        report[3] = (streamSeq >> 24) & 0xff;
+        if( usb_hid.sendReport(setting.in_report_id, report, setting.in_report_len) ) {
+            streamSeq++;
+        }
+    }
     
     // Serial monitor commands
     if( Serial.available() ) {
@@ -178,6 +202,17 @@ void loop()
             Serial.printf("Setting echoReports to %d\n", echoReports);
             drain_serial();
         }
+        else if( cmd == 's' ) {                  // stream input reports
+            streamMillis = Serial.parseInt();
+            streamSeq = 0;
+            streamMillisNext = millis();
+            if( !setting.in_report_len ) {
+                Serial.println("No INPUT report in this mode, not streaming");
+            } else {
+                Serial.printf("Streaming INPUT reports every %d msec\n", streamMillis);
+            }
+            drain_serial();
+        }
         else if( cmd == 'f' || cmd == 'i' ) {    // send feature or input report
             int len = Serial.parseInt();
             if( len==0 ) {
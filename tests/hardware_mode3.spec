@@ -0,0 +1,7 @@
+# Feature report steps for hidtest_tinyusb mode 3 (PID 4444), run in one process:
+#   hidapitester --test-spec tests/hardware_mode3.spec
+--vidpid 27b8:4444 -l 9 --open
+--read-feature 1 --expect 1:0x61,0x62,0x63,0x64
+--send-feature 1,99,44,22
+--read-feature 1 --expect 0:1
+--close
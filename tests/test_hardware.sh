@@ -66,6 +66,8 @@ EEEE)
     check "read feature hex ID matches decimal"  0 "read"     "$BIN" --vidpid "$VID:$PID" -l 9 --open --read-feature 0x02
     # default GET_REPORT (echo off) always returns 'a','b','c','d' = 61 62 63 64
     check "GET_REPORT returns known default bytes"  0 "61 62 63 64"  "$BIN" --vidpid "$VID:$PID" -l 9 --open --read-feature 1
+    # same feature checks as one --test-spec run: one process, one open
+    check "feature test spec passes"  0 "steps passed, 0 failed"  "$BIN" --test-spec "$(dirname "$0")/hardware_mode3.spec"
     ;;
 *)
     printf "Unknown PID '%s' — skipping mode-specific tests\n" "$PID"
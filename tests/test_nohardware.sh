@@ -51,6 +51,7 @@ check "--send-output without open prints error"  0 "Error on send: no device ope
 check "--send-feature without open prints error" 0 "Error on send: no device opened"  "$BIN" --send-feature 1,2,3
 check "--read-input without open prints error"   0 "Error on read: no device opened"  "$BIN" --read-input
 check "--read-feature without open prints error" 0 "Error on read: no device opened"  "$BIN" --read-feature 1
+check "--send-output-file without open"          0 "Error on send: no device opened"  "$BIN" --send-output-file -
 check "--read-input-report without open"         0 "Error on read: no device opened"  "$BIN" --read-input-report 1
 
 # --- hex report ID acceptance (the 0x fix) ---
@@ -58,8 +59,103 @@ check "--read-feature accepts hex 0x01"          0 "Error on read: no device ope
 check "--read-feature accepts hex 0x0a"          0 "Error on read: no device opened"  "$BIN" --read-feature 0x0a
 check "--read-input-report accepts hex 0x01"     0 "Error on read: no device opened"  "$BIN" --read-input-report 0x01
 
+# --- shared-memory ring ---
+check "--shm creates input report ring"          0 "Publishing input reports"  "$BIN" --shm /hidapitester_test
+rm -f /dev/shm/hidapitester_test 2>/dev/null
+
 # --- option validation ---
-check "--width 0 prints error"  0 "print width must be greater than 0"  "$BIN" --width 0 --version
+check "--width 0 prints error"  1 "print width must be greater than 0"  "$BIN" --width 0 --version
+check "--length too large prints error"  1 "length must be between"  "$BIN" --length 5000 --version
+check "--repeat runs command line n times"  0 "Ran 3 iterations"  "$BIN" --repeat 3 --version
+check "--batch out of range prints error"  1 "batch must be between"  "$BIN" --batch -1 --version
+check "--rt bad priority prints error"  1 "priority must be between 1 and 99"  "$BIN" --rt=0 --version
+check "--pipeline without request prints error"  1 "needs a --send-output before it"  "$BIN" --pipeline 10
+check "--duplex rate without report prints error"  1 "needs a --send-output before it"  "$BIN" -l 8 --duplex rate:100
+check "--split-by-report-id bad pattern prints error"  1 "needs one %d or %x"  "$BIN" --split-by-report-id "out%s"
+check "--read-all-interfaces negative window prints error"  1 "window can.t be negative"  "$BIN" --read-all-interfaces=-1
+check "--window out of range prints error"  1 "window must be between 1 and 128"  "$BIN" --window 500 --version
+check "--stress 0 prints error"  1 "stress time must be greater than 0"  "$BIN" --stress 0 --version
+check "--stress without open prints error"  0 "no device opened"  "$BIN" --seed 1 --stress 1
+check "--trace writes trace file"  0 "Trace: wrote 1 hidapi calls"  "$BIN" --trace /tmp/hidapitester_trace.json --close
+rm -f /tmp/hidapitester_trace.json
+check "--bench-sweep bad lengths prints error"  1 "bench-sweep lengths must be"  "$BIN" --bench-sweep=64-8 --version
+check "--expect bad syntax prints error"  1 "needs <offset:bytes>"  "$BIN" --expect 3 --version
+check "--expect with no report fails"  1 "FAIL, no report was read"  "$BIN" --expect 0:1
+check "--test-spec missing file fails"  1 "could not open test spec"  "$BIN" --test-spec /nonexistent.spec
+printf -- '--version\n--expect 1\n--expect 0:1\n' > /tmp/hidapitester_bad.spec
+check "--test-spec bad line fails with file:line"  1 "hidapitester_bad.spec:2: --expect 1"  "$BIN" --test-spec /tmp/hidapitester_bad.spec
+{ echo --version; i=0; while [ $i -lt 33 ]; do printf -- '-l 8 '; i=$((i+1)); done; echo; } > /tmp/hidapitester_bad.spec
+check "--test-spec line with too many args fails"  1 "hidapitester_bad.spec:2: too many arguments"  "$BIN" --test-spec /tmp/hidapitester_bad.spec
+{ echo --version; printf -- '--step %05000d\n' 0; } > /tmp/hidapitester_bad.spec
+check "--test-spec line too long fails"  1 "hidapitester_bad.spec:2: line too long"  "$BIN" --test-spec /tmp/hidapitester_bad.spec
+check "--expect non-number byte prints error"  1 "needs <offset:bytes>"  "$BIN" --expect 1:oops
+check "--reconnect negative prints error"  1 "reconnect time must be 0"  "$BIN" --reconnect=-1 --version
+check "--list-descriptors bad timeout errors"  1 "timeout must be greater than 0"  "$BIN" --list-descriptors=0
+check "--repeat 0 prints error"  1 "repeat count must be greater than 0"  "$BIN" --repeat 0 --version
+
+# --- Input report handling, fed from files with --read-input-file ---
+T=/tmp/hidapitester_test.$$
+mkdir -p "$T"
+
+printf '01 02 ff\n0x01,0x02,0xff\n\n# comment\n0102ff\n1,2,3\n01:02:FF  # trailing\n' > "$T/hex.txt"
+check "hex lines: all formats read"  0 "Read 5 input reports"  "$BIN" -l 3 --read-input-file "$T/hex.txt"
+check "hex lines: separators and 0x"  0 "^ 01 02 FF"  "$BIN" -l 3 --read-input-file "$T/hex.txt"
+check "hex lines: lone digits"  0 "^ 01 02 03"  "$BIN" -l 3 --read-input-file "$T/hex.txt"
+printf '01 0g\n012\n02\n' > "$T/badhex.txt"
+check "hex lines: bad digit rejected"  0 "bad or too long hex on line 1"  "$BIN" -l 3 --read-input-file "$T/badhex.txt"
+check "hex lines: odd digit run rejected"  0 "bad or too long hex on line 2"  "$BIN" -l 3 --read-input-file "$T/badhex.txt"
+check "hex lines: too long rejected"  0 "bad or too long hex on line 1"  sh -c "echo 01 02 03 04 | $BIN -l 3 --read-input-file -"
+
+printf '00\n01\n02\n05\n05\n03\n06\n' > "$T/seq.txt"
+sed 's/^/00 00 00 00 00 00 00 00 /' "$T/seq.txt" > "$T/seq8.txt"
+check "--seq counts gap, duplicate, reorder"  0 \
+    "Seq: received 7, lost 1 (14.286%), duplicates 1, reorders 1, resyncs 0, longest gap 2" \
+    "$BIN" -q -l 1 --seq 0:1 --read-input-file "$T/seq.txt"
+printf '00 10\n01 10\n02 10\n01 00\n02 00\n' > "$T/seq16.txt"
+check "--seq 2-byte counter resyncs on a jump back"  0 \
+    "received 5, lost 0 (0.000%), duplicates 0, reorders 0, resyncs 1" \
+    "$BIN" -q -l 2 --seq 0:2 --read-input-file "$T/seq16.txt"
+
+# check values of each algorithm over "123456789"
+printf '31 32 33 34 35 36 37 38 39 00 00 00 00\n' > "$T/crc.txt"
+check "--verify-crc crc8 check value"   0 "want 0xF4)"       "$BIN" -q -l 13 --verify-crc crc8:0-8:9  --read-input-file "$T/crc.txt"
+check "--verify-crc crc16 check value"  0 "want 0x29B1)"     "$BIN" -q -l 13 --verify-crc crc16:0-8:9 --read-input-file "$T/crc.txt"
+check "--verify-crc crc32 check value"  0 "want 0xCBF43926)" "$BIN" -q -l 13 --verify-crc crc32:0-8:9 --read-input-file "$T/crc.txt"
+check "--verify-crc sum check value"    0 "want 0xDD)"       "$BIN" -q -l 13 --verify-crc sum:0-8:9   --read-input-file "$T/crc.txt"
+check "--verify-crc offsets are decimal"  0 "want 0xF4)"     "$BIN" -q -l 13 --verify-crc crc8:00-08:09 --read-input-file "$T/crc.txt"
+check "--seq offset is decimal"  0 "Seq: received 7, lost 1"  "$BIN" -q -l 9 --seq 08:1 --read-input-file "$T/seq8.txt"
+printf '31 32 33 34 35 36 37 38 39 26 39 F4 CB\n31 32 33 34 35 36 37 38 39 CB F4 39 26\n' > "$T/crc32.txt"
+check "--verify-crc little endian matches"  0 "1 valid, 1 invalid" "$BIN" -q -l 13 --verify-crc crc32:0-8:9 --read-input-file "$T/crc32.txt"
+check "--verify-crc big endian matches"  0 "1 valid, 1 invalid" "$BIN" -q -l 13 --verify-crc crc32:0-8:9:be --read-input-file "$T/crc32.txt"
+
+# nine 1 ms intervals and one 20 ms one
+( for i in 0 1 2 3 4 5 6 7 8 9; do echo "@${i}000 01"; done; echo "@29000 01" ) > "$T/times.txt"
+check "--timestamps interval stats"  0 "10 intervals over 0.029 s, mean 2.900 ms, stddev 6.008 ms, min 1.000 ms, max 20.000 ms" \
+    "$BIN" -q -l 1 --timestamps --read-input-file "$T/times.txt"
+check "--timestamps percentiles"  0 "p50 1.008 ms, p90 19.968 ms, p99 19.968 ms" \
+    "$BIN" -q -l 1 --timestamps --read-input-file "$T/times.txt"
+check "--timestamps flags late reports"  0 "1 late (> 5.000 ms)" \
+    "$BIN" -q -l 1 --timestamps=5000 --read-input-file "$T/times.txt"
+check "--expect checks a report from file"  0 "PASS"  "$BIN" -l 3 --read-input-file "$T/hex.txt" --expect 1:0x02,0xff
+
+# --- report descriptor walker, with --descriptor-file ---
+# report 1: 8 bytes in and out; report 2: 4-bit signed field + 4 bits padding in, 16-bit feature
+printf '06 00 FF 09 01 A1 01\n85 01 75 08 95 08 15 00 26 FF 00 81 02 91 02\n85 02 75 04 95 01 15 F8 25 07 81 02 81 01 75 10 B1 02\nC0\n' > "$T/desc.txt"
+check "descriptor: reports found"  0 "41 bytes, 2 reports"  "$BIN" --descriptor-file "$T/desc.txt"
+check "descriptor: report 1 sizes"  0 "report 1: input 64 bits, output 64 bits, feature 0 bits"  "$BIN" --descriptor-file "$T/desc.txt"
+check "descriptor: padding counted in size"  0 "report 2: input 8 bits, output 0 bits, feature 16 bits"  "$BIN" --descriptor-file "$T/desc.txt"
+check "descriptor: signed field, padding skipped"  0 "input field: report 2, bit 0, 4 bits, signed"  "$BIN" --descriptor-file "$T/desc.txt"
+# Push, change Report Size, Pop: the 8-bit size comes back
+printf '75 08 95 01 A4 75 10 B4 81 02\n' > "$T/push.txt"
+check "descriptor: push/pop restores globals"  0 "report 0: input 8 bits"  "$BIN" --descriptor-file "$T/push.txt"
+printf '75 08 95 01 81\n' > "$T/short.txt"
+check "descriptor: truncated item is malformed"  0 "descriptor is malformed"  "$BIN" --descriptor-file "$T/short.txt"
+printf '75 08 95 01 FE 02 10 AA BB 81 02\n' > "$T/long.txt"
+check "descriptor: long item skipped"  0 "report 0: input 8 bits"  "$BIN" --descriptor-file "$T/long.txt"
+printf '75 08 95 01 81 02 FE 04 10 AA\n' > "$T/longshort.txt"
+check "descriptor: truncated long item is malformed"  0 "descriptor is malformed"  "$BIN" --descriptor-file "$T/longshort.txt"
+
+rm -rf "$T"
 
 printf "\nResults: %d passed, %d failed\n" "$PASS" "$FAIL"
 [ "$FAIL" -eq 0 ]